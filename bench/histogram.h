@@ -0,0 +1,86 @@
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// HDR-style log-linear histogram: every power of two is split into
+// 2^SUB_BITS linear buckets, so a recorded value is off by less than 1%.
+class Histogram {
+public:
+    static const int SUB_BITS = 7;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    Histogram() : counts_(BUCKETS, 0), total_(0), sum_(0), min_(UINT64_MAX), max_(0) {}
+
+    void record(uint64_t value) {
+        counts_[index(value)]++;
+        total_++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const Histogram &other) {
+        for(int i = 0; i < BUCKETS; i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    // q in [0, 1], the upper bound of the bucket holding the quantile
+    uint64_t percentile(double q) const {
+        if(total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * total_ + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, total_));
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKETS; i++) {
+            seen += counts_[i];
+            if(seen >= rank) {
+                return std::min(upper(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0; }
+
+    static int index(uint64_t value) {
+        if(value < static_cast<uint64_t>(SUB_COUNT)) {
+            return static_cast<int>(value);
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + static_cast<int>((value >> shift) - SUB_COUNT);
+    }
+
+    static uint64_t upper(int index) {
+        int group = index >> SUB_BITS;
+        if(group == 0) {
+            return index;
+        }
+        int shift = group - 1;
+        uint64_t sub = (index & (SUB_COUNT - 1)) + SUB_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+#endif
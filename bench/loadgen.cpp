@@ -0,0 +1,551 @@
+// wrk-style HTTP load generator for measuring bin/server over loopback.
+//
+//   loadgen [-h host] [-p port] [-t threads] [-c connections] [-d seconds]
+//           [-P depth] [-k 0|1] [-r resources_dir] [-u url]... [-m metrics_path]
+//           [-l user:password]... [--json]
+//
+// Every thread runs its own epoll loop over its share of the connections.
+// A connection keeps `depth` requests in flight (pipelining) and picks the
+// urls round-robin from the -u list or from the files below -r.
+// With -m the server's tws_syscalls_total is scraped before and after the
+// run and reported per request.
+// Every -l adds a POST /login of that user to the rotation, the async
+// database path under load; put bench/sqldelay in front of the database
+// to see static requests keep flowing while the logins wait.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <memory>
+#include <map>
+
+#include "histogram.h"
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 5423;
+    int threads = 1;
+    int conns = 10;
+    int duration = 10;
+    int depth = 1;
+    bool keepAlive = true;
+    bool json = false;
+    std::string metricsPath;
+    std::vector<std::string> urls;
+    std::vector<std::string> logins;    // "user:password"
+};
+
+struct Stats {
+    Histogram latency; // microseconds
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t status[6] = {0};   // 1xx..5xx, [0] unparsable
+    uint64_t connects = 0;
+    uint64_t errors = 0;        // connect/read/write errors and resets
+};
+
+static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+class Worker {
+public:
+    Worker(const Options &opt, const sockaddr_in &addr, const std::vector<std::string> &requests,
+           int conns, int seed)
+        : opt_(opt), addr_(addr), requests_(requests), next_(seed), gen_(0), epfd_(-1) {
+        conns_.resize(conns);
+    }
+
+    void run(uint64_t deadline) {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        for(size_t i = 0; i < conns_.size(); i++) {
+            connect_(i);
+        }
+        std::vector<epoll_event> events(256);
+        while(nowUs() < deadline) {
+            int n = epoll_wait(epfd_, events.data(), events.size(), 100);
+            for(int i = 0; i < n; i++) {
+                size_t id = events[i].data.u64;
+                if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    fail_(id);
+                    continue;
+                }
+                if(events[i].events & EPOLLOUT) {
+                    onWritable_(id);
+                }
+                if(events[i].events & EPOLLIN) {
+                    onReadable_(id);
+                }
+            }
+        }
+        for(size_t i = 0; i < conns_.size(); i++) {
+            close_(i);
+        }
+        close(epfd_);
+    }
+
+    Stats stats;
+
+private:
+    enum STATE { HEADER, BODY };
+
+    struct Conn {
+        int fd = -1;
+        bool connecting = false;
+        bool wantWrite = false;
+        bool closeAfter = false;    // server sent Connection: close
+        std::deque<uint64_t> sent;  // send time of the requests in flight
+        std::string out;
+        size_t outPos = 0;
+        STATE state = HEADER;
+        std::string head;
+        uint64_t bodyLeft = 0;
+        int status = 0;
+        uint64_t gen = 0;           // changes on every reconnect
+    };
+
+    void connect_(size_t id) {
+        Conn &c = conns_[id];
+        c = Conn();
+        c.gen = ++gen_;
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int ret = connect(c.fd, reinterpret_cast<const sockaddr *>(&addr_), sizeof(addr_));
+        if(ret < 0 && errno != EINPROGRESS) {
+            stats.errors++;
+            ::close(c.fd);
+            c.fd = -1;
+            return;
+        }
+        stats.connects++;
+        c.connecting = true;
+        epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u64 = id;
+        c.wantWrite = true;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    void close_(size_t id) {
+        Conn &c = conns_[id];
+        if(c.fd >= 0) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+            ::close(c.fd);
+            c.fd = -1;
+        }
+    }
+
+    void fail_(size_t id) {
+        stats.errors++;
+        close_(id);
+        connect_(id);
+    }
+
+    void setWrite_(size_t id, bool on) {
+        Conn &c = conns_[id];
+        if(c.wantWrite == on) {
+            return;
+        }
+        c.wantWrite = on;
+        epoll_event ev = {0};
+        ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+        ev.data.u64 = id;
+        epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    // keep the pipeline full
+    void fill_(size_t id) {
+        Conn &c = conns_[id];
+        size_t depth = opt_.keepAlive ? opt_.depth : 1;
+        uint64_t now = nowUs();
+        while(c.sent.size() < depth && !c.closeAfter) {
+            c.out += requests_[next_++ % requests_.size()];
+            c.sent.push_back(now);
+        }
+        flush_(id);
+    }
+
+    void flush_(size_t id) {
+        Conn &c = conns_[id];
+        while(c.outPos < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+            if(n < 0) {
+                if(errno == EAGAIN) {
+                    setWrite_(id, true);
+                    return;
+                }
+                fail_(id);
+                return;
+            }
+            c.outPos += n;
+        }
+        c.out.clear();
+        c.outPos = 0;
+        setWrite_(id, false);
+    }
+
+    void onWritable_(size_t id) {
+        Conn &c = conns_[id];
+        if(c.connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if(err) {
+                fail_(id);
+                return;
+            }
+            c.connecting = false;
+            fill_(id);
+            return;
+        }
+        flush_(id);
+    }
+
+    void onReadable_(size_t id) {
+        static thread_local char buf[65536];
+        while(conns_[id].fd >= 0) {
+            ssize_t n = recv(conns_[id].fd, buf, sizeof(buf), 0);
+            if(n < 0 && errno == EAGAIN) {
+                return;
+            }
+            if(n <= 0) {
+                // a close after the last response of a non keep-alive
+                // connection is expected, anything else is an error
+                Conn &c = conns_[id];
+                if(c.sent.empty() && c.state == HEADER && c.head.empty()) {
+                    close_(id);
+                    connect_(id);
+                } else {
+                    fail_(id);
+                }
+                return;
+            }
+            stats.bytes += n;
+            consume_(id, buf, n);
+        }
+    }
+
+    void consume_(size_t id, const char *data, size_t len) {
+        Conn &c = conns_[id];
+        while(len > 0) {
+            if(c.state == BODY) {
+                size_t n = std::min<uint64_t>(len, c.bodyLeft);
+                c.bodyLeft -= n;
+                data += n;
+                len -= n;
+                if(c.bodyLeft == 0 && !complete_(id)) {
+                    return;
+                }
+                continue;
+            }
+            // look for the end of the header across reads
+            size_t old = c.head.size();
+            c.head.append(data, len);
+            size_t from = old >= 3 ? old - 3 : 0;
+            size_t pos = c.head.find("\r\n\r\n", from);
+            if(pos == std::string::npos) {
+                return;
+            }
+            size_t used = pos + 4 - old;
+            data += used;
+            len -= used;
+            parseHeader_(c, pos + 4);
+            c.head.clear();
+            c.state = BODY;
+            if(c.bodyLeft == 0 && !complete_(id)) {
+                return;
+            }
+        }
+    }
+
+    void parseHeader_(Conn &c, size_t headLen) {
+        const std::string &h = c.head;
+        c.status = 0;
+        c.bodyLeft = 0;
+        if(h.size() >= 12 && h.compare(0, 5, "HTTP/") == 0) {
+            c.status = atoi(h.c_str() + 9);
+        }
+        size_t p = h.find("\r\n");
+        while(p != std::string::npos && p + 2 < headLen) {
+            const char *line = h.c_str() + p + 2;
+            if(strncasecmp(line, "Content-Length:", 15) == 0) {
+                c.bodyLeft = strtoull(line + 15, nullptr, 10);
+            } else if(strncasecmp(line, "Connection:", 11) == 0) {
+                const char *v = line + 11;
+                while(*v == ' ') {
+                    v++;
+                }
+                if(strncasecmp(v, "close", 5) == 0) {
+                    c.closeAfter = true;
+                }
+            }
+            p = h.find("\r\n", p + 2);
+        }
+    }
+
+    // false: the connection was closed, drop the rest of the read
+    bool complete_(size_t id) {
+        Conn &c = conns_[id];
+        uint64_t gen = c.gen;
+        c.state = HEADER;
+        if(!c.sent.empty()) {
+            stats.latency.record(nowUs() - c.sent.front());
+            c.sent.pop_front();
+        }
+        stats.requests++;
+        int cls = c.status / 100;
+        stats.status[(cls >= 1 && cls <= 5) ? cls : 0]++;
+        if(c.closeAfter || !opt_.keepAlive) {
+            if(c.sent.empty()) {
+                close_(id);
+                connect_(id);
+                return false;
+            }
+            return true;
+        }
+        fill_(id);
+        return c.fd >= 0 && c.gen == gen;
+    }
+
+    const Options &opt_;
+    sockaddr_in addr_;
+    const std::vector<std::string> &requests_;
+    std::vector<Conn> conns_;
+    uint64_t next_;
+    uint64_t gen_;
+    int epfd_;
+};
+
+static std::vector<std::string> *g_scan = nullptr;
+static size_t g_scanRoot = 0;
+
+static int scanFile(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    if(flag == FTW_F && st->st_size > 0 && strstr(path, "/.") == nullptr) {
+        g_scan->push_back(std::string(path + g_scanRoot));
+    }
+    return 0;
+}
+
+// tws_syscalls_total by call, empty if the scrape failed
+static std::map<std::string, double> scrapeSyscalls(const sockaddr_in &addr, const Options &opt) {
+    std::map<std::string, double> calls;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return calls;
+    }
+    if(connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return calls;
+    }
+    std::string req = "GET " + opt.metricsPath + " HTTP/1.1\r\nHost: " + opt.host
+                    + "\r\nConnection: close\r\n\r\n";
+    std::string resp;
+    if(write(fd, req.data(), req.size()) == static_cast<ssize_t>(req.size())) {
+        char buf[16384];
+        ssize_t n;
+        while((n = read(fd, buf, sizeof(buf))) > 0) {
+            resp.append(buf, n);
+        }
+    }
+    close(fd);
+
+    static const char KEY[] = "\ntws_syscalls_total{call=\"";
+    size_t pos = 0;
+    while((pos = resp.find(KEY, pos)) != std::string::npos) {
+        pos += sizeof(KEY) - 1;
+        size_t quote = resp.find('"', pos);
+        size_t brace = resp.find("} ", pos);
+        if(quote == std::string::npos || brace == std::string::npos) {
+            break;
+        }
+        calls[resp.substr(pos, quote - pos)] = strtod(resp.c_str() + brace + 2, nullptr);
+    }
+    return calls;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: loadgen [-h host] [-p port] [-t threads] [-c connections] [-d seconds]\n"
+        "               [-P pipeline_depth] [-k 0|1] [-r resources_dir] [-u url]...\n"
+        "               [-m metrics_path] [-l user:password]... [--json]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    std::string resDir;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--json") {
+            opt.json = true;
+            continue;
+        }
+        if(i + 1 >= argc) {
+            usage();
+        }
+        const char *val = argv[++i];
+        if(arg == "-h") opt.host = val;
+        else if(arg == "-p") opt.port = atoi(val);
+        else if(arg == "-t") opt.threads = atoi(val);
+        else if(arg == "-c") opt.conns = atoi(val);
+        else if(arg == "-d") opt.duration = atoi(val);
+        else if(arg == "-P") opt.depth = atoi(val);
+        else if(arg == "-k") opt.keepAlive = atoi(val) != 0;
+        else if(arg == "-r") resDir = val;
+        else if(arg == "-u") opt.urls.push_back(val);
+        else if(arg == "-m") opt.metricsPath = val;
+        else if(arg == "-l" && strchr(val, ':')) opt.logins.push_back(val);
+        else usage();
+    }
+    if(opt.threads < 1 || opt.conns < opt.threads || opt.duration < 1 || opt.depth < 1) {
+        usage();
+    }
+    if(!resDir.empty()) {
+        while(resDir.size() > 1 && resDir.back() == '/') {
+            resDir.pop_back();
+        }
+        g_scan = &opt.urls;
+        g_scanRoot = resDir.size();
+        nftw(resDir.c_str(), scanFile, 16, FTW_PHYS);
+    }
+    if(opt.urls.empty() && opt.logins.empty()) {
+        opt.urls.push_back("/");
+    }
+
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr) != 1) {
+        hostent *he = gethostbyname(opt.host.c_str());
+        if(!he) {
+            fprintf(stderr, "unknown host %s\n", opt.host.c_str());
+            return 1;
+        }
+        memcpy(&addr.sin_addr, he->h_addr_list[0], sizeof(addr.sin_addr));
+    }
+
+    std::vector<std::string> requests;
+    for(const std::string &url : opt.urls) {
+        requests.push_back("GET " + url + " HTTP/1.1\r\nHost: " + opt.host + ":" + std::to_string(opt.port)
+                        + (opt.keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n"));
+    }
+    for(const std::string &login : opt.logins) {
+        size_t colon = login.find(':');
+        std::string body = "username=" + login.substr(0, colon) + "&password=" + login.substr(colon + 1);
+        requests.push_back("POST /login HTTP/1.1\r\nHost: " + opt.host + ":" + std::to_string(opt.port)
+                        + "\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: "
+                        + std::to_string(body.size())
+                        + (opt.keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n")
+                        + body);
+    }
+
+    std::map<std::string, double> syscallsBefore;
+    if(!opt.metricsPath.empty()) {
+        syscallsBefore = scrapeSyscalls(addr, opt);
+        if(syscallsBefore.empty()) {
+            fprintf(stderr, "no tws_syscalls_total at %s\n", opt.metricsPath.c_str());
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(int i = 0; i < opt.threads; i++) {
+        int conns = opt.conns / opt.threads + (i < opt.conns % opt.threads);
+        workers.emplace_back(new Worker(opt, addr, requests, conns, i * 7919));
+    }
+    uint64_t start = nowUs();
+    uint64_t deadline = start + static_cast<uint64_t>(opt.duration) * 1000000;
+    std::vector<std::thread> threads;
+    for(auto &w : workers) {
+        threads.emplace_back([&w, deadline] { w->run(deadline); });
+    }
+    for(auto &t : threads) {
+        t.join();
+    }
+    double secs = (nowUs() - start) / 1e6;
+
+    Stats total;
+    for(auto &w : workers) {
+        total.latency.merge(w->stats.latency);
+        total.requests += w->stats.requests;
+        total.bytes += w->stats.bytes;
+        total.connects += w->stats.connects;
+        total.errors += w->stats.errors;
+        for(int i = 0; i < 6; i++) {
+            total.status[i] += w->stats.status[i];
+        }
+    }
+    // server syscalls per completed request, the scrapes themselves included
+    std::map<std::string, double> syscalls;
+    double syscallsPerReq = 0;
+    if(!syscallsBefore.empty() && total.requests > 0) {
+        std::map<std::string, double> after = scrapeSyscalls(addr, opt);
+        for(const auto &kv : after) {
+            double perReq = (kv.second - syscallsBefore[kv.first]) / total.requests;
+            syscalls[kv.first] = perReq;
+            syscallsPerReq += perReq;
+        }
+    }
+    std::string syscallText, syscallJson;
+    for(const auto &kv : syscalls) {
+        char item[64];
+        snprintf(item, sizeof(item), "  %s %.2f", kv.first.c_str(), kv.second);
+        syscallText += item;
+        snprintf(item, sizeof(item), ",\"%s\":%.3f", kv.first.c_str(), kv.second);
+        syscallJson += item;
+    }
+    if(!syscalls.empty()) {
+        char item[64];
+        snprintf(item, sizeof(item), ",\"syscalls_per_request\":{\"total\":%.3f", syscallsPerReq);
+        syscallJson = item + syscallJson + "}";
+    }
+
+    const Histogram &h = total.latency;
+    if(opt.json) {
+        printf("{\"threads\":%d,\"connections\":%d,\"depth\":%d,\"keepalive\":%s,\"urls\":%zu,"
+               "\"seconds\":%.3f,\"requests\":%llu,\"rps\":%.1f,\"bytes\":%llu,\"connects\":%llu,"
+               "\"errors\":%llu,\"non2xx\":%llu,\"latency_us\":{\"mean\":%.1f,\"p50\":%llu,"
+               "\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}%s}\n",
+               opt.threads, opt.conns, opt.depth, opt.keepAlive ? "true" : "false", requests.size(),
+               secs, (unsigned long long)total.requests, total.requests / secs,
+               (unsigned long long)total.bytes, (unsigned long long)total.connects,
+               (unsigned long long)total.errors,
+               (unsigned long long)(total.requests - total.status[2]), h.mean(),
+               (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.9),
+               (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+               (unsigned long long)h.max(), syscallJson.c_str());
+        return 0;
+    }
+    printf("%d threads, %d connections, depth %d, keep-alive %s, %zu urls, %.2fs\n",
+           opt.threads, opt.conns, opt.depth, opt.keepAlive ? "on" : "off", requests.size(), secs);
+    printf("  requests   %llu (%.1f req/s)\n", (unsigned long long)total.requests, total.requests / secs);
+    printf("  transfer   %.2f MB (%.2f MB/s)\n", total.bytes / 1048576.0, total.bytes / 1048576.0 / secs);
+    printf("  connects   %llu, errors %llu, non-2xx %llu\n", (unsigned long long)total.connects,
+           (unsigned long long)total.errors, (unsigned long long)(total.requests - total.status[2]));
+    printf("  latency    mean %.1fus  p50 %lluus  p90 %lluus  p99 %lluus  p999 %lluus  max %lluus\n",
+           h.mean(), (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.9),
+           (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+           (unsigned long long)h.max());
+    if(!syscalls.empty()) {
+        printf("  syscalls   %.2f/req:%s\n", syscallsPerReq, syscallText.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,499 @@
+// Microbenchmarks of the hot-path classes, one JSON document on stdout.
+//
+//   microbench [-f filter] [-s scale]
+//
+// -f runs only the cases whose name contains filter, -s multiplies the
+// iteration counts (0.1 for a quick check). Compare two commits with
+// e.g. `jq '.results[] | [.name, .ns_per_op]'` on both outputs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "histogram.h"
+#include "../code/buffer/buffer.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/router.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/pool/threadpool.h"
+#include "../code/log/log.h"
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// keeps the optimizer from dropping a computed value
+template<typename T>
+static void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t bytes;         // 0 if not a throughput case
+    const Histogram *lat;   // per-op latency in ns, optional
+};
+
+static std::vector<Result> g_results;
+static const char *g_filter = nullptr;
+static double g_scale = 1.0;
+
+static bool selected(const std::string &name) {
+    return !g_filter || name.find(g_filter) != std::string::npos;
+}
+
+static uint64_t scaled(uint64_t n) {
+    uint64_t v = static_cast<uint64_t>(n * g_scale);
+    return v ? v : 1;
+}
+
+static void report(const std::string &name, uint64_t ops, uint64_t ns,
+                   uint64_t bytes = 0, const Histogram *lat = nullptr) {
+    g_results.push_back({name, ops, ns, bytes, lat});
+    fprintf(stderr, "%-36s %10.1f ns/op\n", name.c_str(), ops ? static_cast<double>(ns) / ops : 0);
+}
+
+// runs fn(iters) once and reports the elapsed time
+static void bench(const std::string &name, uint64_t iters, uint64_t bytesPerOp,
+                  const std::function<void(uint64_t)> &fn) {
+    if(!selected(name)) {
+        return;
+    }
+    uint64_t start = nowNs();
+    fn(iters);
+    report(name, iters, nowNs() - start, bytesPerOp * iters);
+}
+
+/* ---------------- Buffer ---------------- */
+
+static void benchBuffer() {
+    const std::string small(64, 'a');
+    const std::string large(16384, 'b');
+
+    bench("buffer/append_retrieve_64", scaled(5000000), 64, [&](uint64_t n) {
+        Buffer buff;
+        for(uint64_t i = 0; i < n; i++) {
+            buff.append(small);
+            buff.retrieve(small.size());
+        }
+        keep(buff.readableBytes());
+    });
+
+    // grows to 1 MiB then drains, as a big response header would
+    bench("buffer/append_16k_retrieve_all", scaled(200000), 16384, [&](uint64_t n) {
+        Buffer buff;
+        for(uint64_t i = 0; i < n; i++) {
+            buff.append(large);
+            if(buff.readableBytes() >= (1 << 20)) {
+                buff.retrieveAll();
+            }
+        }
+        keep(buff.readableBytes());
+    });
+
+    // compaction path: the reader lags a few bytes behind the writer
+    bench("buffer/append_partial_retrieve", scaled(2000000), 64, [&](uint64_t n) {
+        Buffer buff;
+        for(uint64_t i = 0; i < n; i++) {
+            buff.append(small);
+            buff.retrieve(small.size() - (i & 7));
+            if(buff.readableBytes() > 4096) {
+                buff.retrieveAll();
+            }
+        }
+        keep(buff.readableBytes());
+    });
+
+    const size_t chunks[] = {512, 4096, 65536};
+    for(size_t chunk : chunks) {
+        std::string name = "buffer/readfd_pipe_" + std::to_string(chunk);
+        bench(name, scaled(200000), chunk, [&](uint64_t n) {
+            int fds[2];
+            if(pipe2(fds, O_NONBLOCK) < 0) {
+                return;
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+            std::string data(chunk, 'c');
+            Buffer buff;
+            int err = 0;
+            for(uint64_t i = 0; i < n; i++) {
+                ssize_t w = write(fds[1], data.data(), data.size());
+                keep(w);
+                buff.readFd(fds[0], &err);
+                buff.retrieveAll();
+            }
+            close(fds[0]);
+            close(fds[1]);
+        });
+    }
+}
+
+/* ---------------- HttpRequest::parse ---------------- */
+
+static std::string makeGet(int extraHeaders) {
+    std::string req = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:1316\r\n"
+                      "Connection: keep-alive\r\n";
+    static const char *const names[] = {
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)",
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+        "Accept-Encoding: gzip, deflate, br",
+        "Accept-Language: en-US,en;q=0.9",
+        "Cache-Control: max-age=0",
+        "Upgrade-Insecure-Requests: 1",
+        "Sec-Fetch-Dest: document",
+        "Sec-Fetch-Mode: navigate",
+        "Sec-Fetch-Site: none",
+        "If-Modified-Since: Sat, 01 Jan 2022 00:00:00 GMT",
+    };
+    for(int i = 0; i < extraHeaders; i++) {
+        if(i < 10) {
+            req += names[i];
+        } else {
+            req += "X-Extra-" + std::to_string(i) + ": " + std::string(40, 'x');
+        }
+        req += "\r\n";
+    }
+    return req + "\r\n";
+}
+
+static void benchParseOne(const std::string &name, const std::string &req, size_t split) {
+    bench(name, scaled(500000), req.size(), [&](uint64_t n) {
+        HttpRequest request;
+        Buffer buff;
+        for(uint64_t i = 0; i < n; i++) {
+            request.init();
+            if(split == 0) {
+                buff.append(req);
+                keep(request.parse(buff));
+                continue;
+            }
+            // the request arrives in split byte reads
+            for(size_t off = 0; off < req.size(); off += split) {
+                buff.append(req.data() + off, std::min(split, req.size() - off));
+                keep(request.parse(buff));
+            }
+        }
+    });
+}
+
+static void benchParse() {
+    // the form of a login, checked later by its route
+    std::string form = "username=bench&password=bench";
+    std::string post = "POST /login HTTP/1.1\r\nHost: 127.0.0.1:1316\r\n"
+                       "Content-Type: application/x-www-form-urlencoded\r\n"
+                       "Content-Length: " + std::to_string(form.size()) + "\r\n\r\n" + form;
+    std::string chunked = "POST /upload HTTP/1.1\r\nHost: 127.0.0.1:1316\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n";
+    for(int i = 0; i < 8; i++) {
+        chunked += "200\r\n" + std::string(512, 'd') + "\r\n";
+    }
+    chunked += "0\r\n\r\n";
+
+    benchParseOne("parse/get_minimal", "GET / HTTP/1.1\r\nHost: a\r\n\r\n", 0);
+    benchParseOne("parse/get_browser_12_headers", makeGet(10), 0);
+    benchParseOne("parse/get_40_headers", makeGet(38), 0);
+    benchParseOne("parse/get_browser_split_16", makeGet(10), 16);
+    benchParseOne("parse/post_login_cached", post, 0);
+    benchParseOne("parse/post_chunked_4k", chunked, 0);
+}
+
+/* ---------------- Router ---------------- */
+
+static void benchRouter() {
+    Router *router = Router::instance();
+    Router::Handler none = [](HttpRequest &, const Router::Params &, Router::Reply *) {};
+    const char *pages[] = {"/", "/index", "/welcome", "/video", "/picture", "/login",
+                           "/login.html", "/register", "/register.html", "/metrics", "/debug/trace"};
+    for(const char *page : pages) {
+        router->add("*", page, none);
+    }
+    router->add("GET", "/api/users/:id", none);
+    router->add("GET", "/api/users/:id/posts/:post", none);
+    router->add("GET", "/api/groups/:id", none);
+    router->add("GET", "/static/*file", none);
+
+    struct Case {
+        const char *name;
+        const char *path;
+    } cases[] = {
+        {"router/static_hit", "/register.html"},
+        {"router/param_2", "/api/users/1234/posts/56789"},
+        {"router/wildcard", "/static/css/site/main.css"},
+        {"router/miss_to_file", "/images/profile-1234.jpg"},
+    };
+    std::string method = "GET";
+    for(const Case &c : cases) {
+        bench(c.name, scaled(2000000), 0, [&](uint64_t n) {
+            Router::Params params;
+            for(uint64_t i = 0; i < n; i++) {
+                keep(router->match(method, c.path, &params));
+            }
+        });
+    }
+    router->clear();
+}
+
+/* ---------------- Response body ---------------- */
+
+// what a small file costs both ways, written to a pipe and drained: mmap
+// and munmap plus a two-iovec writev, or a copy after the header, the way
+// inline_file_size picks; where they cross is the threshold to set
+static void benchBody() {
+    const size_t sizes[] = {512, 4096, 16384, 32768};
+    const std::string header(160, 'h');
+    char tmpl[] = "/tmp/microbench_body_XXXXXX";
+    int fd = mkstemp(tmpl);
+    int fds[2];
+    if(fd < 0 || pipe(fds) < 0) {
+        return;
+    }
+    unlink(tmpl);
+    fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+    std::vector<char> sink(1 << 16);
+    auto drain = [&](size_t len) {
+        while(len > 0) {
+            ssize_t got = read(fds[0], sink.data(), std::min(len, sink.size()));
+            if(got <= 0) {
+                break;
+            }
+            len -= got;
+        }
+    };
+    for(size_t size : sizes) {
+        std::string data(size, 'f');
+        if(ftruncate(fd, 0) < 0 || pwrite(fd, data.data(), size, 0) != static_cast<ssize_t>(size)) {
+            break;
+        }
+        std::string suffix = "_" + std::to_string(size);
+        bench("body/mmap_writev" + suffix, scaled(100000), size, [&](uint64_t n) {
+            for(uint64_t i = 0; i < n; i++) {
+                void *file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                struct iovec iov[2] = {{const_cast<char *>(header.data()), header.size()}, {file, size}};
+                keep(writev(fds[1], iov, 2));
+                munmap(file, size);
+                drain(header.size() + size);
+            }
+        });
+        bench("body/inline_write" + suffix, scaled(100000), size, [&](uint64_t n) {
+            Buffer buff;
+            for(uint64_t i = 0; i < n; i++) {
+                buff.append(header);
+                buff.append(data.data(), data.size());
+                keep(write(fds[1], buff.peek(), buff.readableBytes()));
+                buff.retrieveAll();
+                drain(header.size() + size);
+            }
+        });
+    }
+    close(fd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* ---------------- HeapTimer ---------------- */
+
+static void benchTimer() {
+    const int sizes[] = {10000, 100000, 1000000};
+    for(int size : sizes) {
+        int n = size;
+        std::string suffix = "_" + std::to_string(size);
+        std::mt19937 rng(size);
+        std::vector<int> timeouts(n);
+        for(int &t : timeouts) {
+            t = 60000 + static_cast<int>(rng() % 60000);
+        }
+
+        if(selected("timer/add" + suffix)) {
+            HeapTimer timer;
+            uint64_t start = nowNs();
+            for(int i = 0; i < n; i++) {
+                timer.add(i, timeouts[i], [] {});
+            }
+            report("timer/add" + suffix, n, nowNs() - start);
+        }
+
+        // the keep-alive pattern: every request pushes its timer back
+        if(selected("timer/adjust" + suffix)) {
+            HeapTimer timer;
+            for(int i = 0; i < n; i++) {
+                timer.add(i, timeouts[i], [] {});
+            }
+            uint64_t start = nowNs();
+            for(int i = 0; i < n; i++) {
+                timer.adjust(static_cast<int>(rng() % n), 120000 + i % 1000);
+            }
+            report("timer/adjust" + suffix, n, nowNs() - start);
+        }
+
+        // expire everything: tick() pops and runs each callback
+        if(selected("timer/tick_expire" + suffix)) {
+            HeapTimer timer;
+            uint64_t fired = 0;
+            for(int i = 0; i < n; i++) {
+                timer.add(i, 0, [&fired] { fired++; });
+            }
+            uint64_t start = nowNs();
+            timer.tick();
+            report("timer/tick_expire" + suffix, n, nowNs() - start);
+            keep(fired);
+        }
+
+        // nothing due: the cost paid on every loop iteration
+        if(selected("timer/next_tick_idle" + suffix)) {
+            HeapTimer timer;
+            for(int i = 0; i < n; i++) {
+                timer.add(i, timeouts[i], [] {});
+            }
+            uint64_t iters = scaled(1000000);
+            uint64_t start = nowNs();
+            for(uint64_t i = 0; i < iters; i++) {
+                keep(timer.getNextTick());
+            }
+            report("timer/next_tick_idle" + suffix, iters, nowNs() - start);
+        }
+    }
+}
+
+/* ---------------- ThreadPool ---------------- */
+
+static Histogram g_poolLatency;
+
+static void benchThreadPool() {
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    const int workers[] = {1, static_cast<int>(cpus)};
+    for(int w : workers) {
+        std::string name = "threadpool/submit_" + std::to_string(w) + "w";
+        if(selected(name)) {
+            ThreadPool pool(w);
+            uint64_t n = scaled(500000);
+            std::atomic<uint64_t> done(0);
+            uint64_t start = nowNs();
+            for(uint64_t i = 0; i < n; i++) {
+                pool.submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+            while(done.load() < n) {
+                std::this_thread::yield();
+            }
+            report(name, n, nowNs() - start);
+        }
+        if(w == 1 && cpus == 1) {
+            break;
+        }
+    }
+
+    // submit to start of the task, one task in flight
+    if(selected("threadpool/dispatch_latency")) {
+        ThreadPool pool(1);
+        uint64_t n = scaled(100000);
+        uint64_t start = nowNs();
+        for(uint64_t i = 0; i < n; i++) {
+            uint64_t sent = nowNs();
+            pool.submit([sent] {
+                g_poolLatency.record(nowNs() - sent);
+            }).wait();
+        }
+        report("threadpool/dispatch_latency", n, nowNs() - start, 0, &g_poolLatency);
+    }
+}
+
+/* ---------------- Log ---------------- */
+
+static void benchLog() {
+    char dir[] = "/tmp/microbench_log_XXXXXX";
+    if(!mkdtemp(dir)) {
+        return;
+    }
+    // Log's destructor expects an async init() to have run, so it always
+    // happens; async first since init() keeps the queue and writer thread
+    Log::instance()->init(1, dir, ".log", 1024);
+    const int capacity[] = {1024, 0};
+    for(int cap : capacity) {
+        std::string name = cap ? "log/write_async" : "log/write_sync";
+        if(!selected(name)) {
+            continue;
+        }
+        Log::instance()->init(1, dir, ".log", cap);
+        uint64_t n = scaled(1000000);
+        uint64_t start = nowNs();
+        for(uint64_t i = 0; i < n; i++) {
+            LOG_INFO("client[%d] in, user %s, %llu bytes", static_cast<int>(i & 1023), "bench",
+                     static_cast<unsigned long long>(i));
+        }
+        Log::instance()->flush();
+        report(name, n, nowNs() - start);
+    }
+    std::string cmd = std::string("rm -rf ") + dir;
+    if(system(cmd.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir);
+    }
+}
+
+static void printJson() {
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    printf("{\n  \"host\": \"%s\",\n  \"cpus\": %u,\n  \"scale\": %g,\n  \"results\": [",
+           host, std::thread::hardware_concurrency(), g_scale);
+    for(size_t i = 0; i < g_results.size(); i++) {
+        const Result &r = g_results[i];
+        double secs = r.ns / 1e9;
+        printf("%s\n    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.1f",
+               i ? "," : "", r.name.c_str(), static_cast<unsigned long long>(r.ops),
+               r.ops ? static_cast<double>(r.ns) / r.ops : 0, secs > 0 ? r.ops / secs : 0);
+        if(r.bytes) {
+            printf(", \"mb_per_sec\": %.1f", secs > 0 ? r.bytes / 1048576.0 / secs : 0);
+        }
+        if(r.lat) {
+            printf(", \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+                   static_cast<unsigned long long>(r.lat->percentile(0.5)),
+                   static_cast<unsigned long long>(r.lat->percentile(0.99)),
+                   static_cast<unsigned long long>(r.lat->percentile(0.999)),
+                   static_cast<unsigned long long>(r.lat->max()));
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "f:s:")) != -1) {
+        switch(opt) {
+        case 'f':
+            g_filter = optarg;
+            break;
+        case 's':
+            g_scale = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: microbench [-f filter] [-s scale]\n");
+            return 1;
+        }
+    }
+    if(g_scale <= 0) {
+        g_scale = 1.0;
+    }
+    benchBuffer();
+    benchParse();
+    benchRouter();
+    benchBody();
+    benchTimer();
+    benchThreadPool();
+    benchLog();
+    printJson();
+    return 0;
+}
@@ -0,0 +1,167 @@
+// TCP proxy that holds back every reply of a database, a slow MySQL/MariaDB
+// for the async login path without a slow query.
+//
+//   sqldelay [-p listen_port] [-h db_host] [-P db_port] [-d delay_ms]
+//
+// Point the server's sql_port at the proxy and load it with loadgen -l:
+//
+//   sqldelay -p 3307 -P 3306 -d 200 &
+//   bin/server --sql_port 3307 ... &
+//   loadgen -c 64 -u /index.html -l alice:secret
+//
+// With the async path the /index.html latency stays where it is without
+// -l; with workers blocking on the database it grows by about delay_ms.
+// Client to database bytes pass at once, each read from the database is
+// held delay_ms before it is written back. A thread per direction and
+// connection, the pool opens a handful.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <thread>
+#include <chrono>
+
+struct Options {
+    int port = 3307;
+    std::string dbHost = "127.0.0.1";
+    int dbPort = 3306;
+    int delayMs = 100;
+};
+
+static bool writeAll(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// copies until either side closes, then shuts both down so the other
+// direction ends too
+static void pump(int from, int to, int delayMs) {
+    char buf[65536];
+    for(;;) {
+        ssize_t n = recv(from, buf, sizeof(buf), 0);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        if(delayMs > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        }
+        if(!writeAll(to, buf, n)) {
+            break;
+        }
+    }
+    shutdown(from, SHUT_RDWR);
+    shutdown(to, SHUT_RDWR);
+}
+
+static int connectDb(const sockaddr_in &db) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, reinterpret_cast<const sockaddr *>(&db), sizeof(db)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: sqldelay [-p listen_port] [-h db_host] [-P db_port] [-d delay_ms]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            usage();
+        }
+        const char *val = argv[++i];
+        if(arg == "-p") opt.port = atoi(val);
+        else if(arg == "-h") opt.dbHost = val;
+        else if(arg == "-P") opt.dbPort = atoi(val);
+        else if(arg == "-d") opt.delayMs = atoi(val);
+        else usage();
+    }
+    if(opt.port < 1 || opt.dbPort < 1 || opt.delayMs < 0) {
+        usage();
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_in db = {0};
+    db.sin_family = AF_INET;
+    db.sin_port = htons(opt.dbPort);
+    if(inet_pton(AF_INET, opt.dbHost.c_str(), &db.sin_addr) != 1) {
+        hostent *he = gethostbyname(opt.dbHost.c_str());
+        if(!he) {
+            fprintf(stderr, "unknown host %s\n", opt.dbHost.c_str());
+            return 1;
+        }
+        memcpy(&db.sin_addr, he->h_addr_list[0], sizeof(db.sin_addr));
+    }
+
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(listenFd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(listenFd, 128) < 0) {
+        perror("listen");
+        return 1;
+    }
+    printf("127.0.0.1:%d -> %s:%d, replies %dms late\n", opt.port, opt.dbHost.c_str(), opt.dbPort,
+           opt.delayMs);
+    fflush(stdout);
+    for(;;) {
+        int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(client < 0) {
+            if(errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        int server = connectDb(db);
+        if(server < 0) {
+            fprintf(stderr, "connect %s:%d: %s\n", opt.dbHost.c_str(), opt.dbPort, strerror(errno));
+            close(client);
+            continue;
+        }
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread up(pump, client, server, 0);
+        // the pair is closed once both directions ended
+        std::thread([client, server, delayMs = opt.delayMs, up = std::move(up)]() mutable {
+            pump(server, client, delayMs);
+            up.join();
+            close(client);
+            close(server);
+        }).detach();
+    }
+}
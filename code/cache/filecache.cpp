@@ -0,0 +1,350 @@
+#include "filecache.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+static const int OPEN_FLAGS = O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY;
+
+static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+FileCache::Entry::~Entry() {
+    if(map) {
+        munmap(map, st.st_size);
+    }
+}
+
+FileCache *FileCache::instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+FileCache::~FileCache() {
+    clear();
+    if(rootFd_ >= 0) {
+        close(rootFd_);
+    }
+}
+
+bool FileCache::init(const std::string &root, size_t capacity, int ttlMS) {
+    clear();
+    if(rootFd_ >= 0) {
+        close(rootFd_);
+    }
+    capacity_ = capacity;
+    shardCapacity_ = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+    shardMissCapacity_ = (shardCapacity_ + 3) / 4;
+    ttlMS_ = ttlMS;
+    rootFd_ = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(rootFd_ < 0) {
+        LOG_ERROR("Document root %s: %s", root.c_str(), strerror(errno));
+        return false;
+    }
+    struct open_how how = {};
+    how.flags = OPEN_FLAGS;
+    how.resolve = RESOLVE_BENEATH;
+    int fd = syscall(SYS_openat2, rootFd_, ".", &how, sizeof(how));
+    if(fd >= 0) {
+        close(fd);
+    } else if(errno == ENOSYS) {
+        LOG_WARN("openat2 unavailable, symlinks under %s are not confined", root.c_str());
+    }
+    return true;
+}
+
+FileCache::Shard &FileCache::shard_(const std::string &path) {
+    return shards_[std::hash<std::string>()(path) % SHARD_NUM];
+}
+
+static int hexValue(char ch) {
+    if('0' <= ch && ch <= '9') return ch - '0';
+    if('a' <= ch && ch <= 'f') return ch - 'a' + 10;
+    if('A' <= ch && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+bool FileCache::normalize(std::string_view url, std::string *path) {
+    url = url.substr(0, url.find_first_of("?#"));
+    std::string decoded;
+    decoded.reserve(url.size());
+    for(size_t i = 0; i < url.size(); i++) {
+        char ch = url[i];
+        if(ch == '%') {
+            int hi = i + 2 < url.size() ? hexValue(url[i + 1]) : -1;
+            int lo = hi >= 0 ? hexValue(url[i + 2]) : -1;
+            if(lo < 0) {
+                return false;
+            }
+            ch = static_cast<char>(hi * 16 + lo);
+            i += 2;
+        }
+        if(ch == '\0') {
+            return false;
+        }
+        decoded += ch;
+    }
+    // segment by segment, ".." takes the last one back
+    path->clear();
+    size_t begin = 0;
+    while(begin <= decoded.size()) {
+        size_t end = std::min(decoded.find('/', begin), decoded.size());
+        std::string_view seg(decoded.data() + begin, end - begin);
+        if(seg == "..") {
+            if(path->empty()) {
+                return false;
+            }
+            size_t cut = path->rfind('/');
+            path->resize(cut == std::string::npos ? 0 : cut);
+        } else if(!seg.empty() && seg != ".") {
+            if(!path->empty()) {
+                *path += '/';
+            }
+            path->append(seg);
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+int FileCache::open_(const std::string &path, int flags) {
+    if(rootFd_ < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    const char *name = path.empty() ? "." : path.c_str();
+    struct open_how how = {};
+    how.flags = flags;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = syscall(SYS_openat2, rootFd_, name, &how, sizeof(how));
+    if(fd < 0 && errno == ENOSYS) {
+        // before Linux 5.6: no ".." is left after normalize, a symlink may still lead out
+        fd = openat(rootFd_, name, flags);
+    }
+    return fd;
+}
+
+// the whole file into entry->data, false: it changed meanwhile
+bool FileCache::read_(int fd, Entry *entry) {
+    entry->data.resize(entry->st.st_size);
+    size_t got = 0;
+    while(got < entry->data.size()) {
+        ssize_t len = pread(fd, &entry->data[got], entry->data.size() - got, got);
+        Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+        if(len <= 0) {
+            break;
+        }
+        got += len;
+    }
+    if(got != entry->data.size()) {
+        entry->data.clear();
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const FileCache::Entry> FileCache::resolve_(const std::string &path) {
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->expires = Clock::now() + std::chrono::milliseconds(ttlMS_);
+    int fd = open_(path, OPEN_FLAGS);
+    Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+    if(fd < 0 || fstat(fd, &entry->st) < 0) {
+        entry->err = errno;
+        if(entry->err == EMFILE || entry->err == ENFILE || entry->err == ENOMEM) {
+            // says nothing about the path, try again next time
+            entry->expires = Clock::time_point();
+        }
+    }
+    if(fd < 0) {
+        return entry;
+    }
+    Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+    size_t size = entry->st.st_size;
+    if(entry->err == 0 && S_ISREG(entry->st.st_mode) && size > 0) {
+        if(size <= inlineSize_ && read_(fd, entry.get())) {
+            entry->inlined = true;
+        } else if(!map_(fd, entry.get())) {
+            entry->err = errno;
+            entry->expires = Clock::time_point();
+        }
+    }
+    close(fd);
+    Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+    return entry;
+}
+
+// small files are faulted in by MAP_POPULATE once, large ones are read
+// ahead and advised sequential, huge ones get 2 MiB aligned addresses
+// and MADV_HUGEPAGE, so the page cache may back them with huge pages
+bool FileCache::map_(int fd, Entry *entry) {
+    size_t size = entry->st.st_size;
+    size_t hugeSize = hugepageSize_;
+    bool huge = hugeSize > 0 && size >= hugeSize;
+    bool populate = !huge && size <= populateSize_;
+    void *map;
+    if(huge) {
+        // reserve one huge page more, map at the aligned address inside
+        // and give back the rest
+        size_t span = size + HUGE_PAGE;
+        char *area = static_cast<char *>(mmap(nullptr, span, PROT_NONE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if(area == MAP_FAILED) {
+            return false;
+        }
+        char *aligned = reinterpret_cast<char *>(
+            (reinterpret_cast<uintptr_t>(area) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+        map = mmap(aligned, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if(map == MAP_FAILED) {
+            munmap(area, span);
+            return false;
+        }
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        char *end = aligned + (size + pageSize - 1) / pageSize * pageSize;
+        if(aligned > area) {
+            munmap(area, aligned - area);
+        }
+        if(end < area + span) {
+            munmap(end, area + span - end);
+        }
+        madvise(map, size, MADV_HUGEPAGE);
+        madvise(map, size, MADV_WILLNEED);
+        Metrics::instance()->addSyscall(Metrics::SYS_FILE, 6);
+    } else {
+        map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+        if(map == MAP_FAILED) {
+            return false;
+        }
+        if(!populate) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            readahead(fd, 0, std::min<size_t>(size, readaheadSize_));
+            Metrics::instance()->addSyscall(Metrics::SYS_FILE, 2);
+        }
+    }
+    entry->map = map;
+    return true;
+}
+
+// an O_PATH open reads no data and confines like open_ does
+bool FileCache::unchanged_(const std::string &path, const Entry &entry) {
+    int fd = open_(path, O_PATH | O_CLOEXEC);
+    if(fd < 0) {
+        Metrics::instance()->addSyscall(Metrics::SYS_FILE);
+        return false;
+    }
+    struct stat st;
+    bool same = fstat(fd, &st) == 0
+        && st.st_dev == entry.st.st_dev && st.st_ino == entry.st.st_ino
+        && st.st_size == entry.st.st_size
+        && st.st_mtim.tv_sec == entry.st.st_mtim.tv_sec
+        && st.st_mtim.tv_nsec == entry.st.st_mtim.tv_nsec;
+    close(fd);
+    Metrics::instance()->addSyscall(Metrics::SYS_FILE, 3);
+    return same;
+}
+
+std::shared_ptr<const FileCache::Entry> FileCache::lookup(std::string_view url) {
+    std::string path;
+    if(!normalize(url, &path)) {
+        static const std::shared_ptr<const Entry> INVALID = [] {
+            std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+            entry->err = EINVAL;
+            return entry;
+        }();
+        return INVALID;
+    }
+    if(capacity_ == 0) {
+        misses_++;
+        return resolve_(path);
+    }
+    Shard &shard = shard_(path);
+    std::shared_ptr<const Entry> stale;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.entries.find(path);
+        if(it != shard.entries.end()) {
+            if(it->second.entry->expires > Clock::now()) {
+                std::list<std::string> &lru = shard.lruOf(it->second);
+                lru.splice(lru.begin(), lru, it->second.lru);
+                hits_++;
+                return it->second.entry;
+            }
+            stale = it->second.entry;
+        }
+    }
+    // an unchanged file keeps its mapping, nothing is read or faulted in
+    // again; errors are resolved anew, that is as cheap
+    if(stale && stale->err == 0 && unchanged_(path, *stale)) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        stale->expires = Clock::now() + std::chrono::milliseconds(ttlMS_);
+        auto it = shard.entries.find(path);
+        if(it != shard.entries.end() && it->second.entry == stale) {
+            std::list<std::string> &lru = shard.lruOf(it->second);
+            lru.splice(lru.begin(), lru, it->second.lru);
+        }
+        revalidations_++;
+        return stale;
+    }
+    misses_++;
+    // resolved unlocked, a racing miss of the same path resolves it too
+    std::shared_ptr<const Entry> entry = resolve_(path);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.entries.find(path);
+    if(it != shard.entries.end()) {
+        // a miss may have become a file or the other way round
+        shard.lruOf(it->second).erase(it->second.lru);
+        shard.entries.erase(it);
+    }
+    // a miss only ever evicts another miss
+    std::list<std::string> &lru = entry->err ? shard.missLru : shard.lru;
+    if(lru.size() >= (entry->err ? shardMissCapacity_ : shardCapacity_) && !lru.empty()) {
+        shard.entries.erase(lru.back());
+        lru.pop_back();
+        evictions_++;
+    }
+    lru.push_front(path);
+    it = shard.entries.emplace(path, Slot()).first;
+    it->second.entry = entry;
+    it->second.lru = lru.begin();
+    return entry;
+}
+
+void FileCache::setMapPolicy(size_t populateSize, size_t hugepageSize, size_t readaheadSize) {
+    bool changed = populateSize_.exchange(populateSize) != populateSize;
+    changed = hugepageSize_.exchange(hugepageSize) != hugepageSize || changed;
+    readaheadSize_ = readaheadSize;
+    if(changed) {
+        clear();
+    }
+}
+
+void FileCache::setInlineSize(size_t bytes) {
+    if(inlineSize_.exchange(bytes) != bytes) {
+        clear();
+    }
+}
+
+void FileCache::clear() {
+    for(Shard &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        shard.entries.clear();
+        shard.lru.clear();
+        shard.missLru.clear();
+    }
+}
+
+size_t FileCache::size() {
+    size_t total = 0;
+    for(Shard &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        total += shard.entries.size();
+    }
+    return total;
+}
@@ -0,0 +1,118 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <unordered_map>
+#include <sys/stat.h>
+
+// URL path -> stat and contents of a file under the document root.
+// A path is normalized once ("%xx", ".", "..", "//", the query) and
+// resolved against an O_PATH fd of the root with openat2 and
+// RESOLVE_BENEATH, so neither ".." nor a symlink leads out of it.
+// Results, misses included, are kept for ttl and dropped on clear(),
+// a hit costs no syscall. Misses and errors are bounded by an LRU of
+// their own, a quarter of capacity on top of it, so a scan of paths
+// that do not exist never pushes a mapped file out. An expired file is stat'ed again and, if its
+// inode, size and mtime are the same, kept for another ttl with its
+// contents. Bounded and sharded like the UserCache.
+// Files up to the inline size are read into the entry, larger ones are
+// mapped once and the mapping shared by every response until the entry
+// goes; the fd is closed either way. How a file is mapped depends on
+// its size, see setMapPolicy().
+class FileCache {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        int err;            // 0, or the errno of the lookup
+        bool inlined;       // data holds the whole file
+        std::string data;
+        void *map;          // the whole file otherwise, nullptr if empty
+        struct stat st;
+        mutable Clock::time_point expires;  // extended under the shard lock
+
+        Entry() : err(0), inlined(false), map(nullptr), st{} {}
+        ~Entry();
+    };
+
+    static FileCache *instance();
+    // capacity 0 still resolves safely but keeps nothing
+    bool init(const std::string &root, size_t capacity = 1024, int ttlMS = 1000);
+
+    // never nullptr; err EINVAL: a path that does not normalize
+    std::shared_ptr<const Entry> lookup(std::string_view url);
+    void clear();
+    // files up to populateSize are mapped with MAP_POPULATE; larger ones
+    // MADV_SEQUENTIAL and read ahead by readaheadSize; from hugepageSize
+    // (0: never) 2 MiB aligned with MADV_HUGEPAGE. A change drops the cache
+    void setMapPolicy(size_t populateSize, size_t hugepageSize, size_t readaheadSize);
+    // 0: never inline; a change drops the cache
+    void setInlineSize(size_t bytes);
+    size_t inlineSize() const {
+        return inlineSize_;
+    }
+
+    // "/a/./b//c/../d?q" -> "a/b/d", "" is the root; false: a NUL,
+    // a bad escape, or above the root
+    static bool normalize(std::string_view url, std::string *path);
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    uint64_t revalidations() const { return revalidations_; }
+    size_t size();
+
+private:
+    struct Slot {
+        std::shared_ptr<const Entry> entry;
+        std::list<std::string>::iterator lru;   // in missLru if entry->err
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Slot> entries;
+        std::list<std::string> lru;     // front: most recently used
+        std::list<std::string> missLru; // the same for misses and errors
+
+        std::list<std::string> &lruOf(const Slot &slot) {
+            return slot.entry->err ? missLru : lru;
+        }
+    };
+
+    FileCache() : rootFd_(-1), capacity_(0), shardCapacity_(0), shardMissCapacity_(0), ttlMS_(0) {}
+    ~FileCache();
+
+    Shard &shard_(const std::string &path);
+    std::shared_ptr<const Entry> resolve_(const std::string &path);
+    int open_(const std::string &path, int flags);
+    // the file at path is still the one entry was made from
+    bool unchanged_(const std::string &path, const Entry &entry);
+    static bool read_(int fd, Entry *entry);
+    bool map_(int fd, Entry *entry);
+
+    static const int SHARD_NUM = 16;
+
+    int rootFd_;
+    size_t capacity_;
+    size_t shardCapacity_;
+    size_t shardMissCapacity_;
+    int ttlMS_;
+    std::atomic<size_t> inlineSize_{0};
+    std::atomic<size_t> populateSize_{0};
+    std::atomic<size_t> hugepageSize_{0};
+    std::atomic<size_t> readaheadSize_{0};
+    Shard shards_[SHARD_NUM];
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> revalidations_{0};
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "usercache.h"
+
+#include <random>
+#include <algorithm>
+
+UserCache::UserCache() : capacity_(0), shardCapacity_(0), ttlMS_(0), negativeTtlMS_(0) {
+    std::random_device rd;
+    for(uint64_t &k : key_) {
+        k = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+}
+
+UserCache *UserCache::instance() {
+    static UserCache cache;
+    return &cache;
+}
+
+void UserCache::init(size_t capacity, int ttlMS, int negativeTtlMS) {
+    clear();
+    capacity_ = capacity;
+    shardCapacity_ = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+    ttlMS_ = ttlMS;
+    negativeTtlMS_ = negativeTtlMS;
+}
+
+UserCache::Shard &UserCache::shard_(const std::string &name) {
+    return shards_[std::hash<std::string>()(name) % SHARD_NUM];
+}
+
+static inline uint64_t rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sipRound(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) {
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+
+// SipHash-2-4 of pwd under key_
+uint64_t UserCache::hash_(const std::string &pwd) const {
+    uint64_t v0 = key_[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key_[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key_[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key_[1] ^ 0x7465646279746573ULL;
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(pwd.data());
+    size_t len = pwd.size();
+    uint64_t last = static_cast<uint64_t>(len) << 56;
+    for(size_t i = 0; i < len; i += 8) {
+        uint64_t m = 0;
+        size_t n = std::min<size_t>(8, len - i);
+        for(size_t j = 0; j < n; j++) {
+            m |= static_cast<uint64_t>(p[i + j]) << (8 * j);
+        }
+        if(n < 8) {
+            last |= m;
+            break;
+        }
+        v3 ^= m;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    v3 ^= last;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for(int i = 0; i < 4; i++) {
+        sipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+UserCache::RESULT UserCache::lookup(const std::string &name, const std::string &pwd, bool &match) {
+    if(!isEnabled()) {
+        return MISS;
+    }
+    uint64_t pwdHash = hash_(pwd);
+    Shard &shard = shard_(name);
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.entries.find(name);
+        if(it != shard.entries.end()) {
+            Entry &entry = it->second;
+            if(entry.expires > Clock::now()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+                if(entry.exists) {
+                    match = entry.pwdHash == pwdHash;
+                    hits_++;
+                    return HIT;
+                }
+                negativeHits_++;
+                return NEGATIVE;
+            }
+            shard.lru.erase(entry.lru);
+            shard.entries.erase(it);
+        }
+    }
+    misses_++;
+    return MISS;
+}
+
+void UserCache::put(const std::string &name, const std::string &pwd) {
+    insert_(name, hash_(pwd), true, ttlMS_);
+}
+
+void UserCache::putNegative(const std::string &name) {
+    insert_(name, 0, false, negativeTtlMS_);
+}
+
+void UserCache::insert_(const std::string &name, uint64_t pwdHash, bool exists, int ttlMS) {
+    if(!isEnabled() || ttlMS <= 0) {
+        return;
+    }
+    Shard &shard = shard_(name);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.entries.find(name);
+    if(it == shard.entries.end()) {
+        // evict the least recently used entry of a full shard
+        if(shard.entries.size() >= shardCapacity_ && !shard.lru.empty()) {
+            shard.entries.erase(shard.lru.back());
+            shard.lru.pop_back();
+            evictions_++;
+        }
+        shard.lru.push_front(name);
+        it = shard.entries.emplace(name, Entry()).first;
+        it->second.lru = shard.lru.begin();
+    } else {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+    }
+    it->second.pwdHash = pwdHash;
+    it->second.exists = exists;
+    it->second.expires = Clock::now() + std::chrono::milliseconds(ttlMS);
+}
+
+void UserCache::invalidate(const std::string &name) {
+    if(!isEnabled()) {
+        return;
+    }
+    Shard &shard = shard_(name);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.entries.find(name);
+    if(it != shard.entries.end()) {
+        shard.lru.erase(it->second.lru);
+        shard.entries.erase(it);
+    }
+}
+
+void UserCache::clear() {
+    for(int i = 0; i < SHARD_NUM; i++) {
+        std::lock_guard<std::mutex> lock(shards_[i].mtx);
+        shards_[i].entries.clear();
+        shards_[i].lru.clear();
+    }
+}
+
+size_t UserCache::size() {
+    size_t n = 0;
+    for(int i = 0; i < SHARD_NUM; i++) {
+        std::lock_guard<std::mutex> lock(shards_[i].mtx);
+        n += shards_[i].entries.size();
+    }
+    return n;
+}
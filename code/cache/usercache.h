@@ -0,0 +1,87 @@
+#ifndef USERCACHE_H
+#define USERCACHE_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+#include <assert.h>
+
+// bounded, sharded cache of username -> stored password in front of the
+// user table. Unknown users are cached too (negative entries) with a
+// shorter ttl, so login bursts barely reach the SqlConnPool.
+// The password is kept as a SipHash-2-4 under a random key of the
+// process, never in cleartext; a login compares the hashes.
+class UserCache {
+public:
+    enum RESULT {
+        MISS,
+        HIT,        // match: pwd is the stored password
+        NEGATIVE,   // the user is known not to exist
+    };
+
+    static const size_t CAPACITY = 10000;
+    static const int TTL_MS = 60000;
+    static const int NEGATIVE_TTL_MS = 5000;
+
+    static UserCache *instance();
+    // capacity 0 disables the cache, negativeTtlMS 0 the negative entries
+    void init(size_t capacity = CAPACITY, int ttlMS = TTL_MS, int negativeTtlMS = NEGATIVE_TTL_MS);
+
+    RESULT lookup(const std::string &name, const std::string &pwd, bool &match);
+    void put(const std::string &name, const std::string &pwd);
+    void putNegative(const std::string &name);
+    void invalidate(const std::string &name);
+    void clear();
+
+    bool isEnabled() const { return capacity_ > 0; }
+    uint64_t hits() const { return hits_; }
+    uint64_t negativeHits() const { return negativeHits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    size_t size();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        uint64_t pwdHash;
+        bool exists;
+        Clock::time_point expires;
+        std::list<std::string>::iterator lru;
+    };
+
+    // one lock per shard, padded so shards do not share a cache line
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru; // front: most recently used
+    };
+
+    UserCache();
+    ~UserCache() = default;
+
+    Shard &shard_(const std::string &name);
+    uint64_t hash_(const std::string &pwd) const;
+    void insert_(const std::string &name, uint64_t pwdHash, bool exists, int ttlMS);
+
+    static const int SHARD_NUM = 16;
+
+    size_t capacity_;
+    size_t shardCapacity_;
+    int ttlMS_;
+    int negativeTtlMS_;
+    uint64_t key_[2];
+    Shard shards_[SHARD_NUM];
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> negativeHits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+#endif
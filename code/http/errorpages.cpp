@@ -0,0 +1,93 @@
+#include "errorpages.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+ErrorPages *ErrorPages::instance() {
+    static ErrorPages pages;
+    return &pages;
+}
+
+bool ErrorPages::readFile_(const std::string &path, std::string *body) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if(ok) {
+        body->resize(st.st_size);
+        size_t got = 0;
+        while(got < body->size()) {
+            ssize_t len = read(fd, &(*body)[got], body->size() - got);
+            if(len <= 0) {
+                break;
+            }
+            got += len;
+        }
+        body->resize(got);
+        ok = got == static_cast<size_t>(st.st_size);
+    }
+    close(fd);
+    return ok;
+}
+
+void ErrorPages::load(const std::string &srcDir) {
+    std::shared_ptr<Pages> pages = std::make_shared<Pages>();
+    int files = 0;
+    for(size_t i = 0; i < HttpTables::STATUS_COUNT; i++) {
+        const HttpTables::Status &status = HttpTables::STATUS[i];
+        if(status.code < 400) {
+            continue;
+        }
+        std::string body;
+        if(!status.page.empty() && readFile_(srcDir + std::string(status.page), &body)) {
+            files++;
+        } else {
+            if(!status.page.empty()) {
+                LOG_WARN("Error page %s unreadable, generated instead", std::string(status.page).c_str());
+            }
+            // as HttpResponse::errorContent
+            std::string reason(status.reason());
+            body = "<html><title>Error</title><body bgcolor=\"ffffff\">"
+                   + std::to_string(status.code) + " : " + reason + "\n"
+                   + "<p>" + reason + "</p><hr><em>TinyWebServer</em></body></html>";
+        }
+        // the headers of HttpResponse::addHeader_
+        for(int keepAlive = 0; keepAlive < 2; keepAlive++) {
+            std::string &ready = pages->ready[i][keepAlive];
+            ready.reserve(body.size() + 160);
+            ready.append(status.line);
+            ready.append(keepAlive ? "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n"
+                                   : "Connection: close\r\n");
+            if(status.code == 503) {
+                ready.append("Retry-After: 1\r\n");
+            }
+            ready.append("Content-type: text/html\r\n");
+            ready.append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+            ready.append(body);
+        }
+    }
+    pages_.store(std::move(pages));
+    LOG_INFO("Error pages: %d read from %s", files, srcDir.c_str());
+}
+
+std::shared_ptr<const std::string> ErrorPages::response(int code, bool keepAlive) const {
+    const HttpTables::Status *status = HttpTables::status(code);
+    std::shared_ptr<const Pages> pages = pages_.load();
+    if(!pages || !status || code < 400) {
+        return nullptr;
+    }
+    // shares the set's ownership
+    return std::shared_ptr<const std::string>(pages, &pages->ready[status - HttpTables::STATUS][keepAlive]);
+}
+
+bool ErrorPages::append(int code, bool keepAlive, Buffer &buff) const {
+    std::shared_ptr<const std::string> ready = response(code, keepAlive);
+    if(!ready) {
+        return false;
+    }
+    buff.append(ready->data(), ready->size());
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef ERROR_PAGES_H
+#define ERROR_PAGES_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "httptables.h"
+
+// Whole error responses, status line, headers and body, rendered once at
+// startup and on reload: an error is answered from memory, no stat, open
+// or mmap. A 4xx/5xx code whose status has a page gets the page, the
+// others a generated body.
+class ErrorPages {
+public:
+    static ErrorPages *instance();
+
+    // reads the pages under srcDir; responses in use keep the old set
+    void load(const std::string &srcDir);
+    // appends the response of code; false: none loaded
+    bool append(int code, bool keepAlive, Buffer &buff) const;
+    // nullptr: none loaded
+    std::shared_ptr<const std::string> response(int code, bool keepAlive) const;
+
+private:
+    ErrorPages() = default;
+
+    struct Pages {
+        // by index into HttpTables::STATUS, [0] close, [1] keep-alive
+        std::string ready[HttpTables::STATUS_COUNT][2];
+    };
+
+    static bool readFile_(const std::string &path, std::string *body);
+
+    std::atomic<std::shared_ptr<const Pages>> pages_;
+};
+
+#endif
@@ -2,12 +2,19 @@
 
 const char* HttpConn::srcDir;
 bool HttpConn::isET;
+bool HttpConn::cork;
 std::atomic<int> HttpConn::userCount;
+std::atomic<bool> HttpConn::draining;
 
 HttpConn::HttpConn() {
     fd_ = -1;
     addr_ = { 0 };
+    generation_ = 0;
     isclose_ = true;
+    corked_ = false;
+    interim_ = false;
+    parseTime_ = Metrics::Clock::duration::zero();
+    tracing_ = false;
 }
 
 HttpConn::~HttpConn() {
@@ -19,18 +26,32 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    generation_++;
     writeBuff_.retrieveAll();
     readBuff_.retrieveAll();
+    iov_[0].iov_len = iov_[1].iov_len = 0;
+    iovCnt_ = 0;
+    corked_ = false;
+    interim_ = false;
+    // the slot may hold a request left unfinished by the previous client
+    request_.init();
+    request_.setLoopback((ntohl(addr.sin_addr.s_addr) >> 24) == 127);
+    parseTime_ = Metrics::Clock::duration::zero();
+    tracing_ = false;
     isclose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount: %d", fd_, getIP(), getPort(), (int) userCount);
 }
 
 void HttpConn::close() {
     response_.unmapFile();
+    if(tracing_) {
+        traceDone_();
+    }
     if(isclose_ == false) {
         isclose_ = true;
         userCount--;
         ::close(fd_);
+        Metrics::instance()->addSyscall(Metrics::SYS_CLOSE);
         LOG_INFO("Client[%d](%s:%d) quit, userCount: %d", fd_, getIP(), getPort(), (int) userCount);
     }
 }
@@ -53,30 +74,61 @@ int HttpConn::getPort() const {
 
 ssize_t HttpConn::read(int* saveErrno) {
     ssize_t len = -1;
+    size_t total = 0;
+    int calls = 0;
+    uint64_t tick = tracing_ ? Tracer::now() : 0;
     do {
         // scatter read
         len = readBuff_.readFd(fd_, saveErrno);
+        calls++;
         if(len <= 0) {
             break;
         }
+        total += len;
     }while(isET); // edge triggered, read all out at once
+    Metrics::instance()->addSyscall(Metrics::SYS_READ, calls);
+    if(total) {
+        Metrics::instance()->add(Metrics::BYTES_IN, total);
+    }
+    if(tracing_) {
+        trace_.add(RequestTrace::READ, tick, Tracer::now(), total);
+    }
+    TRACE_PROBE(read, fd_, total);
     return len;
 }
 
+// corked the kernel sends only full segments, the uncork at the end
+// flushes the tail; a response that fits one writev needs neither
+void HttpConn::setCork_(bool on) {
+    int val = on;
+    setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+    Metrics::instance()->addSyscall(Metrics::SYS_SOCKOPT);
+    corked_ = on;
+}
+
 // gather write
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
+    size_t total = 0;
+    int calls = 0;
+    if(cork && !corked_ && toWriteBytes() > CORK_MIN) {
+        setCork_(true);
+    }
     do {
         // write the iov data to fd, gather write
+        uint64_t tick = tracing_ ? Tracer::now() : 0;
         len = writev(fd_, iov_, iovCnt_);
+        calls++;
+        if(tracing_) {
+            trace_.add(RequestTrace::WRITEV, tick, Tracer::now(), len > 0 ? len : 0);
+        }
+        TRACE_PROBE(writev, fd_, len);
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        // end of write
-        if(iov_[0].iov_len + iov_[1].iov_len == 0) {
-            break;
-        } else if(static_cast<size_t>(len) > iov_[0].iov_len) {
+        total += len;
+        if(static_cast<size_t>(len) > iov_[0].iov_len) {
             iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
             iov_[1].iov_len -= (len - iov_[0].iov_len);
             if(iov_[0].iov_len) {
@@ -88,22 +140,109 @@ ssize_t HttpConn::write(int* saveErrno) {
             iov_[0].iov_len -= len;
             writeBuff_.retrieve(len);
         }
+        // end of write, no empty writev to find out
+        if(toWriteBytes() == 0) {
+            break;
+        }
     } while (isET || toWriteBytes() > 10240);
+    Metrics::instance()->addSyscall(Metrics::SYS_WRITE, calls);
+    if(total) {
+        Metrics::instance()->add(Metrics::BYTES_OUT, total);
+    }
+    if(toWriteBytes() == 0) {
+        if(corked_) {
+            setCork_(false);
+        }
+        if(!interim_) {
+            Metrics::instance()->observe(Metrics::WRITE, writeStart_);
+            if(tracing_) {
+                traceDone_();
+            }
+        }
+    }
     return len; 
 }
 
 bool HttpConn::process() {
-    request_.init();
+    interim_ = false;
+    // a partial request is kept across reads
+    if(request_.isFinish()) {
+        request_.init();
+        parseTime_ = Metrics::Clock::duration::zero();
+    }
     if(readBuff_.readableBytes() <= 0) {
         return false;
-    } else if(request_.parse(readBuff_)) {
+    }
+    reply_.clear();
+    Metrics::Clock::time_point start = Metrics::Clock::now();
+    uint64_t tick = tracing_ ? Tracer::now() : 0;
+    HttpRequest::HTTP_CODE ret = request_.parse(readBuff_);
+    if(tracing_) {
+        trace_.add(RequestTrace::PARSE, tick, Tracer::now());
+    }
+    parseTime_ += Metrics::Clock::now() - start;
+    TRACE_PROBE(parse_done, fd_, ret);
+    if(ret != HttpRequest::NO_REQUEST) {
+        Metrics::instance()->observe(Metrics::PARSE,
+            std::chrono::duration_cast<std::chrono::microseconds>(parseTime_).count());
+    }
+    if(ret == HttpRequest::NO_REQUEST) {
+        if(request_.needContinue()) {
+            // written like a response, the request is read on after it
+            const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            writeBuff_.append(CONTINUE, sizeof(CONTINUE) - 1);
+            iov_[0].iov_base = const_cast<char*>(writeBuff_.peek());
+            iov_[0].iov_len = writeBuff_.readableBytes();
+            iovCnt_ = 1;
+            interim_ = true;
+            return true;
+        }
+        return false;
+    } else if(ret == HttpRequest::GET_REQUEST) {
         // parse success
         LOG_DEBUG("%s", request_.path().c_str());
-        response_.init(srcDir, request_.path(), request_.isKeepAlive(), 200);
+        Router::instance()->dispatch(request_, &reply_);
+        if(request_.isVerifying()) {
+            // parked on the database, the response is made by verified()
+            return false;
+        }
+        response_.init(request_.path(), request_.isKeepAlive() && !draining, request_.code());
+    } else {
+        Metrics::instance()->add(Metrics::PARSE_ERRORS);
+        // the stream can not be resynchronized, close after the error
+        int code = 400;
+        if(ret == HttpRequest::ENTITY_TOO_LARGE) {
+            code = 413;
+        } else if(ret == HttpRequest::INTERNAL_ERROR) {
+            code = 500;
+        }
+        response_.init(request_.path(), false, code);
+    }
+    makeResponse_();
+    return true;
+}
+
+void HttpConn::verified(UserStore::RESULT res) {
+    request_.verified(res);
+    response_.init(request_.path(), request_.isKeepAlive() && !draining, request_.code());
+    makeResponse_();
+}
+
+void HttpConn::makeResponse_() {
+    Metrics::Clock::time_point start = Metrics::Clock::now();
+    uint64_t tick = tracing_ ? Tracer::now() : 0;
+    // a route answered from memory
+    if(!reply_.type.empty()) {
+        response_.makeResponse(writeBuff_, reply_.body, reply_.type);
     } else {
-        response_.init(srcDir, request_.path(), request_.isKeepAlive(), 400);
+        response_.makeResponse(writeBuff_);
+    }
+    if(tracing_) {
+        trace_.add(RequestTrace::LOOKUP, tick, Tracer::now());
+        trace_.code = response_.code();
+        trace_.setPath(request_.path());
     }
-    response_.makeResponse(writeBuff_);
+    TRACE_PROBE(response, fd_, response_.code());
     // response header
     iov_[0].iov_base = const_cast<char*>(writeBuff_.peek());
     iov_[0].iov_len = writeBuff_.readableBytes();
@@ -115,7 +254,29 @@ bool HttpConn::process() {
         iov_[1].iov_len = response_.fileLen();
         iovCnt_ = 2;
     }
+    writeStart_ = Metrics::Clock::now();
+    Metrics::instance()->observe(Metrics::PROCESS, start);
+    Metrics::instance()->addStatus(response_.code());
     LOG_DEBUG("filesize:%d, %d to %d", response_.fileLen(), iovCnt_, toWriteBytes());
-    return true;
 }
 
+void HttpConn::traceQueued(bool isRead) {
+    if(!tracing_ && isRead && Tracer::instance()->sample()) {
+        tracing_ = true;
+        trace_.reset(fd_);
+    }
+    if(tracing_) {
+        queuedTick_ = Tracer::now();
+    }
+}
+
+void HttpConn::traceDequeued() {
+    if(tracing_) {
+        trace_.add(RequestTrace::QUEUE, queuedTick_, Tracer::now());
+    }
+}
+
+void HttpConn::traceDone_() {
+    tracing_ = false;
+    Tracer::instance()->submit(trace_);
+}
\ No newline at end of file
@@ -3,14 +3,18 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <errno.h>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
+#include "../metrics/metrics.h"
+#include "../metrics/tracer.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "router.h"
 
 class HttpConn {
 public:
@@ -27,23 +31,61 @@ public:
     const char* getIP() const;
     sockaddr_in getAddr() const;
     bool process();
+    void verified(UserStore::RESULT res);
+
+    bool isClose() const {
+        return isclose_;
+    }
+
+    // changes on every init(): a callback that outlives its client
+    // sees another one in the same slot
+    uint64_t generation() const {
+        return generation_;
+    }
+
+    const HttpRequest& request() const {
+        return request_;
+    }
+
+    // read, not parsed yet
+    size_t readableBytes() const {
+        return readBuff_.readableBytes();
+    }
 
     // write total length
     int toWriteBytes() {
         return iov_[0].iov_len + iov_[1].iov_len;
     }
 
+    // an interim "100 Continue" keeps the conn for the rest of its request
     bool isKeepAlive() const {
-        return request_.isKeepAlive();
+        return interim_ || response_.isKeepAlive();
     }
 
     static bool isET;
+    static bool cork;   // TCP_CORK around responses of several writev
     static const char* srcDir;
     static std::atomic<int> userCount;
+    static std::atomic<bool> draining;  // answer with Connection: close
+    // called by the loop before a read/write task is queued, a new
+    // request may be picked for tracing only on read
+    void traceQueued(bool isRead);
+    // called by the worker when the task starts
+    void traceDequeued();
+
 private:
+    void makeResponse_();
+    void setCork_(bool on);
+    void traceDone_();
+
+    static const int CORK_MIN = 65536;
+
     int fd_;
     struct sockaddr_in addr_;
+    std::atomic<uint64_t> generation_;
     bool isclose_;
+    bool corked_;
+    bool interim_;      // iov_ holds "100 Continue", not a response
     int iovCnt_;
     struct iovec iov_[2];
 
@@ -52,5 +94,13 @@ private:
 
     HttpRequest request_;
     HttpResponse response_;
+    Router::Reply reply_;   // of the request's route, if it has one
+
+    Metrics::Clock::duration parseTime_;    // of the request so far
+    Metrics::Clock::time_point writeStart_;
+
+    bool tracing_;
+    uint64_t queuedTick_;
+    RequestTrace trace_;
 };
 #endif
\ No newline at end of file
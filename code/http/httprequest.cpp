@@ -1,140 +1,348 @@
 #include "httprequest.h"
 
-const std::unordered_set<std::string> HttpRequest::DEFAULT_HTML {
-    "/index", "/register", "/login",
-    "/welcome", "/video", "/picture",
-};
+bool HttpRequest::asyncVerify;
+UserStore *HttpRequest::userStore;
 
-const std::unordered_map<std::string, int> HttpRequest::DEFAULT_HTML_TAG {
-    {"/register.html", 0}, 
-    {"/login.html", 1},
+const char *const HttpRequest::HEADER_NAME[HDR_COUNT] = {
+    "Host", "Connection", "Content-Length", "Content-Type",
+    "Transfer-Encoding", "Expect", "Accept-Encoding",
+    "If-Modified-Since", "Range", "User-Agent",
 };
 
+size_t HttpRequest::maxBodySize = 8 * 1024 * 1024;
+size_t HttpRequest::spillBodySize = 256 * 1024;
+const char *HttpRequest::spillDir = "/tmp";
+
+HttpRequest::~HttpRequest() {
+    if(bodyFd_ >= 0) {
+        close(bodyFd_);
+    }
+}
+
 void HttpRequest::init() {
     method_ = path_ = version_ = body_ = "";
     state_ = REQUEST_LINE;
-    header_.clear();
+    code_ = 200;
+    verifying_ = verifyLogin_ = form_ = false;
+    bodyLen_ = contentLeft_ = 0;
+    continue_ = false;
+    if(bodyFd_ >= 0) {
+        close(bodyFd_);
+        bodyFd_ = -1;
+    }
+    headerBuf_.clear();
+    fieldCnt_ = 0;
+    std::fill(known_, known_ + HDR_COUNT, -1);
     post_.clear();
 }
 
 bool HttpRequest::isKeepAlive() const {
-    if(header_.count("Connection")) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    HeaderSpan conn = header(HDR_CONNECTION);
+    if(version_ == "1.1") {
+        // persistent unless told otherwise
+        return !conn.hasToken("close");
+    }
+    return conn.hasToken("keep-alive");
+}
+
+HttpRequest::HeaderSpan HttpRequest::header(HEADER id) const {
+    assert(id >= 0 && id < HDR_COUNT);
+    if(known_[id] < 0) {
+        return {nullptr, 0};
+    }
+    const HeaderField &field = fields_[known_[id]];
+    return {headerBuf_.data() + field.value, field.valueLen};
+}
+
+HttpRequest::HeaderSpan HttpRequest::header(const char *name) const {
+    assert(name);
+    size_t len = strlen(name);
+    for(size_t i = 0; i < fieldCnt_; i++) {
+        const HeaderField &field = fields_[i];
+        if(field.nameLen == len && strncasecmp(headerBuf_.data() + field.name, name, len) == 0) {
+            return {headerBuf_.data() + field.value, field.valueLen};
+        }
+    }
+    return {nullptr, 0};
+}
+
+bool HttpRequest::HeaderSpan::equalsNoCase(const char *str) const {
+    size_t n = strlen(str);
+    return len == n && strncasecmp(data, str, n) == 0;
+}
+
+bool HttpRequest::HeaderSpan::hasToken(const char *token) const {
+    size_t n = strlen(token);
+    const char *p = data, *end = data + len;
+    while(p < end) {
+        const char *comma = std::find(p, end, ',');
+        const char *b = p, *e = comma;
+        while(b < e && (*b == ' ' || *b == '\t')) b++;
+        while(e > b && (e[-1] == ' ' || e[-1] == '\t')) e--;
+        if(static_cast<size_t>(e - b) == n && strncasecmp(b, token, n) == 0) {
+            return true;
+        }
+        p = comma + (comma < end);
     }
     return false;
 }
 
-bool HttpRequest::parse(Buffer &buff) {
+bool HttpRequest::needContinue() {
+    bool res = continue_;
+    continue_ = false;
+    return res;
+}
+
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer &buff) {
     const char CRLF[] = "\r\n";
-    if(buff.readableBytes() <= 0) {
-        return false;
-    }
-    // read data
-    while(buff.readableBytes() && state_ != FINISH) {
-        // split by "\r\n"
+    HTTP_CODE ret = NO_REQUEST;
+    while(state_ != FINISH) {
+        if(state_ == BODY || state_ == CHUNK_DATA) {
+            // consume whatever part of the body has arrived
+            size_t len = std::min(buff.readableBytes(), contentLeft_);
+            if(len == 0) {
+                return NO_REQUEST;
+            }
+            if(!appendBody_(buff.peek(), len)) {
+                return INTERNAL_ERROR;
+            }
+            buff.retrieve(len);
+            contentLeft_ -= len;
+            if(contentLeft_ == 0) {
+                if(state_ == BODY) {
+                    finishBody_();
+                } else {
+                    state_ = CHUNK_CRLF;
+                }
+            }
+            continue;
+        }
+        // split by "\r\n", a line is only parsed once complete
         const char* lineEnd = std::search(buff.peek(), buff.beginWriteConst(), CRLF, CRLF + 2);
-        // turn into string
-        std::string line(buff.peek(), lineEnd);
+        if(lineEnd == buff.beginWriteConst()) {
+            return buff.readableBytes() > MAX_LINE ? BAD_REQUEST : NO_REQUEST;
+        }
+        const char* lineBegin = buff.peek();
+        bool empty = (lineBegin == lineEnd);
         switch (state_) { // DFA
         case REQUEST_LINE:
-            if(!parseRequestLine_(line)) {
-                return false;
+            if(!parseRequestLine_(lineBegin, lineEnd)) {
+                return BAD_REQUEST;
             }
-            parsePath_();
             break;
         case HEADERS:
-            parseHeader_(line);
-            if(buff.readableBytes() <= 2) {
-                state_ = FINISH;
+            if(!empty) {
+                if(!parseHeader_(lineBegin, lineEnd)) {
+                    return BAD_REQUEST;
+                }
+            } else if((ret = parseFraming_()) != NO_REQUEST) {
+                buff.retrieveUntil(lineEnd + 2);
+                return ret;
             }
             break;
-        case BODY:
-            parseBody_(line);
+        case CHUNK_SIZE:
+            if((ret = parseChunkSize_(lineBegin, lineEnd)) != NO_REQUEST) {
+                return ret;
+            }
+            break;
+        case CHUNK_CRLF:
+            if(!empty) {
+                return BAD_REQUEST;
+            }
+            state_ = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER:
+            // trailer fields are ignored
+            if(empty) {
+                finishBody_();
+            }
             break;
         default:
             break;
         }
-        // finished reading
-        if(lineEnd == buff.beginWrite()) {
-            break; 
-        }
         // skip the enter and newline
         buff.retrieveUntil(lineEnd + 2);
     }
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    return GET_REQUEST;
+}
+
+// METHOD SP request-target SP HTTP/version
+bool HttpRequest::parseRequestLine_(const char *begin, const char *end) {
+    const char *sp1 = std::find(begin, end, ' ');
+    const char *sp2 = std::find(sp1 + (sp1 < end), end, ' ');
+    if(sp1 == begin || sp2 == end || sp2 == sp1 + 1
+        || std::find(sp2 + 1, end, ' ') != end
+        || end - sp2 - 1 < 5 || strncmp(sp2 + 1, "HTTP/", 5) != 0) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    method_.assign(begin, sp1);
+    path_.assign(sp1 + 1, sp2);
+    version_.assign(sp2 + 6, end);
+    state_ = HEADERS;
     return true;
 }
 
-// decode the path
-void HttpRequest::parsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html";
-    } else {
-        for(auto &item : DEFAULT_HTML) if(item == path_) {
-            path_ += ".html";
+bool HttpRequest::parseHeader_(const char *begin, const char *end) {
+    const char *colon = std::find(begin, end, ':');
+    if(colon == begin || colon == end || fieldCnt_ >= MAX_HEADERS
+        || headerBuf_.size() + (end - begin) > MAX_HEADER_BYTES) {
+        LOG_ERROR("Header Error");
+        return false;
+    }
+    const char *value = colon + 1;
+    while(value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    const char *valueEnd = end;
+    while(valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+        valueEnd--;
+    }
+    HeaderField &field = fields_[fieldCnt_];
+    field.name = headerBuf_.size();
+    field.nameLen = colon - begin;
+    headerBuf_.append(begin, colon);
+    field.value = headerBuf_.size();
+    field.valueLen = valueEnd - value;
+    headerBuf_.append(value, valueEnd);
+    // intern the well-known names, the first occurrence wins
+    for(int id = 0; id < HDR_COUNT; id++) {
+        if(known_[id] < 0 && strlen(HEADER_NAME[id]) == field.nameLen
+            && strncasecmp(HEADER_NAME[id], begin, field.nameLen) == 0) {
+            known_[id] = static_cast<int>(fieldCnt_);
             break;
         }
     }
+    fieldCnt_++;
+    return true;
 }
 
-bool HttpRequest::parseRequestLine_(const std::string &line) {
-    std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch subMatch;
-    // In the matching rules, groups are divided by brackets().
-    // Three brackets in total
-    // [0] indicate the overall
-    if(std::regex_match(line, subMatch, pattern)) {
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+// the empty line after the headers: decide how the body is framed
+HttpRequest::HTTP_CODE HttpRequest::parseFraming_() {
+    HeaderSpan te = header(HDR_TRANSFER_ENCODING);
+    HeaderSpan cl = header(HDR_CONTENT_LENGTH);
+    if(te.data) {
+        if(!te.hasToken("chunked")) {
+            return BAD_REQUEST;
+        }
+        state_ = CHUNK_SIZE;
+    } else if(cl.data) {
+        if(cl.empty() || cl.len > 18 || std::find_if(cl.data, cl.data + cl.len,
+                [](char ch) { return ch < '0' || ch > '9'; }) != cl.data + cl.len) {
+            return BAD_REQUEST;
+        }
+        contentLeft_ = 0;
+        for(size_t i = 0; i < cl.len; i++) {
+            contentLeft_ = contentLeft_ * 10 + (cl.data[i] - '0');
+        }
+        if(contentLeft_ > maxBodySize) {
+            return ENTITY_TOO_LARGE;
+        }
+        if(contentLeft_ == 0) {
+            finishBody_();
+            return NO_REQUEST;
+        }
+        state_ = BODY;
+    } else {
+        // no body
+        finishBody_();
+        return NO_REQUEST;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    continue_ = header(HDR_EXPECT).equalsNoCase("100-continue");
+    return NO_REQUEST;
 }
 
-void HttpRequest::parseHeader_(const std::string &line) {
-    std::regex pattern("^([^:]*): ?(.*)$");
-    std::smatch subMatch;
-    if(std::regex_match(line, subMatch, pattern)) {
-        header_[subMatch[1]] = subMatch[2];
-    } else {
-        state_ = BODY;
+HttpRequest::HTTP_CODE HttpRequest::parseChunkSize_(const char *begin, const char *end) {
+    // chunk extensions after ';' are ignored
+    const char *hexEnd = std::find(begin, end, ';');
+    while(hexEnd > begin && (hexEnd[-1] == ' ' || hexEnd[-1] == '\t')) {
+        hexEnd--;
+    }
+    if(hexEnd == begin || hexEnd - begin > 15) {
+        return BAD_REQUEST;
+    }
+    contentLeft_ = 0;
+    for(const char *p = begin; p < hexEnd; p++) {
+        if(!isxdigit(static_cast<unsigned char>(*p))) {
+            return BAD_REQUEST;
+        }
+        contentLeft_ = contentLeft_ * 16 + converHex(*p);
+    }
+    if(bodyLen_ + contentLeft_ > maxBodySize) {
+        return ENTITY_TOO_LARGE;
+    }
+    state_ = contentLeft_ ? CHUNK_DATA : CHUNK_TRAILER;
+    return NO_REQUEST;
+}
+
+// keep small bodies in memory, spill large ones to an unlinked temp file
+bool HttpRequest::appendBody_(const char *data, size_t len) {
+    if(bodyFd_ < 0 && body_.size() + len > spillBodySize) {
+        bodyFd_ = open(spillDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if(bodyFd_ < 0) {
+            std::string tmpl = std::string(spillDir) + "/body.XXXXXX";
+            bodyFd_ = mkostemp(&tmpl[0], O_CLOEXEC);
+            if(bodyFd_ >= 0) {
+                unlink(tmpl.c_str());
+            }
+        }
+        if(bodyFd_ < 0) {
+            LOG_ERROR("Spill body error: %s", strerror(errno));
+            return false;
+        }
+        LOG_DEBUG("Spill body to fd[%d]", bodyFd_);
+        std::string head;
+        head.swap(body_);
+        if(!appendBody_(head.data(), head.size())) {
+            return false;
+        }
+        bodyLen_ -= head.size();
+    }
+    bodyLen_ += len;
+    if(bodyFd_ < 0) {
+        body_.append(data, len);
+        return true;
+    }
+    while(len > 0) {
+        ssize_t n = write(bodyFd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Spill body error: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
     }
+    return true;
 }
 
-void HttpRequest::parseBody_(const std::string &line) {
-    body_ = line;
-    parsePost_();
+void HttpRequest::finishBody_() {
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len: %d", line.c_str(), line.size());
+    if(bodyFd_ < 0) {
+        parsePost_();
+    }
+    LOG_DEBUG("Body len: %d%s", (int)bodyLen_, bodyFd_ >= 0 ? " (spilled)" : "");
 }
 
 int HttpRequest::converHex(char ch) {
     if('A' <= ch && ch <= 'F') return ch - 'A' + 10;
     if('a' <= ch && ch <= 'f') return ch - 'a' + 10;
-    return ch; // ch - '0' ?
+    if('0' <= ch && ch <= '9') return ch - '0';
+    return 0;
 }
 
 // process the post request
 void HttpRequest::parsePost_() {
-    if(method_ == "POST" && header_["Content_Type"] == "application/x-ww-form-urlencoded") {
+    HeaderSpan type = header(HDR_CONTENT_TYPE);
+    // "application/x-www-form-urlencoded; charset=..." is fine too
+    const char FORM[] = "application/x-www-form-urlencoded";
+    if(method_ == "POST" && type.len >= sizeof(FORM) - 1
+        && strncasecmp(type.data, FORM, sizeof(FORM) - 1) == 0) {
         parseFromUrlencoded_();
-        // login/register request
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(userVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } else {
-                    path_ = "/error.html";
-                }
-            }
-            
-        }
+        form_ = true;
     }
 }
 
@@ -179,66 +387,84 @@ void HttpRequest::parseFromUrlencoded_() {
     }
 }
 
-bool HttpRequest::userVerify(const std::string &name, const std::string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") {
-        return false;
+void HttpRequest::verifyUser(bool isLogin) {
+    int cached = cacheVerify_(getPost("username"), getPost("password"), isLogin);
+    if(cached >= 0) {
+        path_ = cached ? "/welcome.html" : "/error.html";
+    } else if(asyncVerify) {
+        // resolved later by verified()
+        verifying_ = true;
+        verifyLogin_ = isLogin;
+    } else {
+        verified(userVerify(getPost("username"), getPost("password"), isLogin));
     }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    // sqlConnPool must initialize ?
-    SqlConnRAII(&sql, SqlConnPool::instance());
-    assert(sql);
-    
-    bool flag = false;
-    char order[256]{0};
-    MYSQL_RES *res = nullptr;
+}
 
-    if(!isLogin) {
-        // register
-        flag = true; 
+void HttpRequest::verified(UserStore::RESULT res) {
+    verifying_ = false;
+    if(res == UserStore::UNAVAILABLE) {
+        // the credentials were never checked, the client may retry
+        code_ = 503;
+        return;
     }
+    path_ = res == UserStore::OK ? "/welcome.html" : "/error.html";
+}
 
-    snprintf(order, 256, "SELECT username, password, FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
+// answer from the credential cache when possible
+int HttpRequest::cacheVerify_(const std::string &name, const std::string &pwd, bool isLogin) {
+    if(name == "" || pwd == "") {
+        return 0;
+    }
+    bool match = false;
+    UserCache::RESULT res = UserCache::instance()->lookup(name, pwd, match);
+    if(res == UserCache::HIT) {
+        // login: compare, register: the name is used
+        return isLogin && match;
+    }
+    if(res == UserCache::NEGATIVE && isLogin) {
+        return 0;
+    }
+    // a cached unknown user may have registered since, ask the database
+    return -1;
+}
 
-    if(mysql_query(sql, order)) {
-        mysql_free_result(res);
-        return false;
+UserStore::RESULT HttpRequest::userVerify(const std::string &name, const std::string &pwd, bool isLogin) {
+    if(name == "" || pwd == "") {
+        return UserStore::FAILED;
     }
+    LOG_INFO("Verify name:%s", name.c_str());
+    assert(userStore);
 
-    res = mysql_store_result(sql);
+    bool found = false;
+    std::string password;
 
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        std::string password(row[1]);
-        if(isLogin) {
-            if(pwd == password) {
-                flag = true; 
-            } else {
-                flag = false;
-                LOG_INFO("%s: pwd error", name);
-            }
-        } else {
-            flag = false;
-            LOG_INFO("user %s used", name);
-        }
+    UserStore::RESULT res = userStore->query(name, password, found);
+    if(res != UserStore::OK) {
+        return res;
+    }
+    if(found) {
+        UserCache::instance()->put(name, password);
+    } else {
+        UserCache::instance()->putNegative(name);
     }
-    mysql_free_result(res);
 
-    if(!isLogin && flag == true) {
-        LOG_DEBUG("%s: register", name);
-        bzero(order, 256);
-        snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s', '%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG("%s", order);
-        if(mysql_query(sql, order)) {
-            LOG_DEBUG("Insert error");
-            flag = false;
+    if(isLogin) {
+        res = found && pwd == password ? UserStore::OK : UserStore::FAILED;
+        if(found && res != UserStore::OK) {
+            LOG_INFO("%s: pwd error", name.c_str());
         }
+    } else if(found) {
+        LOG_INFO("user %s used", name.c_str());
+        res = UserStore::FAILED;
+    } else {
+        LOG_DEBUG("%s: register", name.c_str());
+        res = userStore->insert(name, pwd);
+        // drop the negative entry of the new user
+        UserCache::instance()->invalidate(name);
     }
-    SqlConnPool::instance()->freeConn(sql);
-    LOG_DEBUG("User verify success");
+    LOG_DEBUG("User verify %s", res == UserStore::OK ? "success" : "failed");
     Log::instance()->flush();
-    return flag;
+    return res;
 }
 
 std::string HttpRequest::path() const {
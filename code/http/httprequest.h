@@ -4,28 +4,75 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>
+#include <algorithm>
 #include <errno.h>
-#include <mysql/mysql.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
+#include "../cache/usercache.h"
+#include "../user/userstore.h"
 
 class HttpRequest {
 public:
     enum PARSE_STATE {
         REQUEST_LINE,
         HEADERS,
-        BODY,
+        BODY,           // Content-Length body
+        CHUNK_SIZE,     // chunked body
+        CHUNK_DATA,
+        CHUNK_CRLF,
+        CHUNK_TRAILER,
         FINISH,
     };
 
-    HttpRequest() {init(); }
-    ~HttpRequest() = default;
+    // well-known headers, interned to a slot when parsed
+    enum HEADER {
+        HDR_HOST,
+        HDR_CONNECTION,
+        HDR_CONTENT_LENGTH,
+        HDR_CONTENT_TYPE,
+        HDR_TRANSFER_ENCODING,
+        HDR_EXPECT,
+        HDR_ACCEPT_ENCODING,
+        HDR_IF_MODIFIED_SINCE,
+        HDR_RANGE,
+        HDR_USER_AGENT,
+        HDR_COUNT,
+    };
+
+    // a header value inside the request, not NUL terminated
+    struct HeaderSpan {
+        const char *data;
+        size_t len;
+        bool empty() const {
+            return len == 0;
+        }
+        bool equalsNoCase(const char *str) const;
+        bool hasToken(const char *token) const; // comma separated list
+    };
+
+    enum HTTP_CODE {
+        NO_REQUEST,         // incomplete, wait for more data
+        GET_REQUEST,        // a whole request is parsed
+        BAD_REQUEST,
+        ENTITY_TOO_LARGE,
+        INTERNAL_ERROR,
+    };
+
+    HttpRequest() : bodyFd_(-1), loopback_(false) {init(); }
+    ~HttpRequest();
 
     void init();
-    bool parse(Buffer &buff);
+    // consumes what it can, a request may span several calls
+    HTTP_CODE parse(Buffer &buff);
+    bool isFinish() const {
+        return state_ == FINISH;
+    }
+    // true once, when the client waits for "100 Continue" before the body
+    bool needContinue();
 
     std::string path() const;
     std::string &path();
@@ -34,26 +81,102 @@ public:
     std::string getPost(const std::string &key) const;
     std::string getPost(const char* key) const;
 
+    // the body is in body() or, above spillBodySize, in the unlinked file bodyFd()
+    const std::string &body() const {
+        return body_;
+    }
+    int bodyFd() const {
+        return bodyFd_;
+    }
+    size_t bodyLen() const {
+        return bodyLen_;
+    }
+
     bool isKeepAlive() const;
+
+    // the client is on 127.0.0.0/8, kept across init() for the connection
+    bool isLoopback() const {
+        return loopback_;
+    }
+    void setLoopback(bool loopback) {
+        loopback_ = loopback;
+    }
+
+    // {nullptr, 0} if absent
+    HeaderSpan header(HEADER id) const;
+    HeaderSpan header(const char *name) const; // case-insensitive
+
+    // an urlencoded POST body, read with getPost()
+    bool hasForm() const {
+        return form_;
+    }
+    // checks the form's username and password: path() becomes the
+    // welcome or the error page, or the request parks on the async sql
+    // path until verified()
+    void verifyUser(bool isLogin);
+    // login/register parked on the async sql path
+    bool isVerifying() const {
+        return verifying_;
+    }
+    bool isLoginVerify() const {
+        return verifyLogin_;
+    }
+    void verified(UserStore::RESULT res);
+    // 200, or 503 when the user store had no connection for the request
+    int code() const {
+        return code_;
+    }
+
+    static bool asyncVerify;
+    static UserStore *userStore;
+    static size_t maxBodySize;      // larger bodies are refused with 413
+    static size_t spillBodySize;    // larger bodies go to a temp file
+    static const char *spillDir;
 private:
-    bool parseRequestLine_(const std::string &line);    // processing request line
-    void parseHeader_(const std::string &line);         // processing request header
-    void parseBody_(const std::string &line);           // processing request body
+    static const size_t MAX_LINE = 8192;
+    static const size_t MAX_HEADERS = 64;
+    static const size_t MAX_HEADER_BYTES = 16384;
+    static const char *const HEADER_NAME[HDR_COUNT];
+
+    // [begin, end) is one line without CRLF
+    bool parseRequestLine_(const char *begin, const char *end);     // processing request line
+    bool parseHeader_(const char *begin, const char *end);          // processing request header
+    HTTP_CODE parseFraming_();                                      // Content-Length or chunked
+    HTTP_CODE parseChunkSize_(const char *begin, const char *end);  // processing chunk size line
+    bool appendBody_(const char *data, size_t len);     // processing request body
+    void finishBody_();
 
-    void parsePath_();              // processing the request url
     void parsePost_();              // processing the post request
     void parseFromUrlencoded_();    // decode the url
 
-    static bool userVerify(const std::string &name, const std::string &pwd, bool isLogin); // verify user
+    static UserStore::RESULT userVerify(const std::string &name, const std::string &pwd, bool isLogin); // verify user
+    static int cacheVerify_(const std::string &name, const std::string &pwd, bool isLogin); // -1: cache miss
     static int converHex(char ch);  // convert hexadecimal to decimal
 
     PARSE_STATE state_;
+    int code_;
+    bool verifying_;
+    bool verifyLogin_;
+    bool form_;
     std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
-    std::unordered_map<std::string, std::string> post_;
+    size_t bodyLen_;
+    size_t contentLeft_;    // bytes left of the body or of the current chunk
+    int bodyFd_;
+    bool loopback_;
+    bool continue_;
+
+    // header names and values are copied into headerBuf_, whose capacity is
+    // kept across requests, and referenced by offset: no allocation per request
+    struct HeaderField {
+        uint32_t name, nameLen;
+        uint32_t value, valueLen;
+    };
+    std::string headerBuf_;
+    HeaderField fields_[MAX_HEADERS];
+    size_t fieldCnt_;
+    int known_[HDR_COUNT];  // index into fields_, -1 if absent
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
+    std::unordered_map<std::string, std::string> post_;
 };
 
 #endif
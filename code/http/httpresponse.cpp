@@ -1,43 +1,8 @@
 #include "httpresponse.h"
 
-const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
-};
-
-const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
-    {200, "OK"},
-    {400, "Bad Request"},
-    {403, "Forbidden"},
-    {404, "Not Found"},
-};
-
-const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
-    {400, "/400.html"},
-    {403, "/403.html"},
-    {404, "/404.html"},
-};
-
 HttpResponse::HttpResponse() {
     code_ = -1;
-    path_ = srcDir_ = "";
+    path_ = "";
     isKeepAlive_ = false;
     mmFile_ = nullptr;
     mmFileStat_ = {0};
@@ -47,22 +12,33 @@ HttpResponse::~HttpResponse() {
     unmapFile();
 }
 
-void HttpResponse::init(const std::string &srcDir, std::string &path, bool isKeepAlive, int code) {
-    assert(srcDir.size());
-    if(mmFile_) {
-        unmapFile(); 
-    }
+void HttpResponse::init(std::string &path, bool isKeepAlive, int code) {
+    unmapFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
-    srcDir_ = srcDir;
+    file_.reset();
     mmFile_ = nullptr;
     mmFileStat_ = {0};
 }
 
 void HttpResponse::makeResponse(Buffer &buff) {
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
-    // not found or directory 
+    if(code_ != -1 && code_ != 200) {
+    // error decided by the request, keep it
+    } else if(int err = stat_()) {
+        if(err == EINVAL) {
+        // does not normalize, e.g. "/../"
+            code_ = 400;
+        } else if(err == ENOENT || err == ENOTDIR) {
+            code_ = 404;
+        } else if(err == EMFILE || err == ENFILE || err == ENOMEM) {
+            code_ = 500;
+        } else {
+        // out of the root or forbidden
+            code_ = 403;
+        }
+    } else if(S_ISDIR(mmFileStat_.st_mode)) {
+    // directory
         code_ = 404;
     } else if(!(mmFileStat_.st_mode & S_IROTH)) {
     // other unreadable
@@ -70,12 +46,28 @@ void HttpResponse::makeResponse(Buffer &buff) {
     } else if(code_ == -1) {
         code_ = 200;
     }
+    if(code_ >= 400 && ErrorPages::instance()->append(code_, isKeepAlive_, buff)) {
+        // preloaded, no file behind it
+        path_.clear();
+        mmFileStat_ = {0};
+        return;
+    }
     errorHtml_();
     addStateLine_(buff);
-    addHeader_(buff);
+    addHeader_(buff, getFileType_());
     addContent_(buff);
 }
 
+void HttpResponse::makeResponse(Buffer &buff, const std::string &body, const std::string &type) {
+    code_ = 200;
+    path_.clear();
+    mmFileStat_ = {0};
+    addStateLine_(buff);
+    addHeader_(buff, type);
+    buff.append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+    buff.append(body);
+}
+
 char* HttpResponse::file() {
     return mmFile_;
 }
@@ -84,23 +76,37 @@ size_t HttpResponse::fileLen() const {
     return mmFileStat_.st_size;
 }
 
+int HttpResponse::stat_() {
+    file_ = FileCache::instance()->lookup(path_);
+    mmFileStat_ = {0};
+    if(file_->err == 0) {
+        mmFileStat_ = file_->st;
+    }
+    return file_->err;
+}
+
 void HttpResponse::errorHtml_() {
-    if(CODE_PATH.count(code_)) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+    const HttpTables::Status *status = HttpTables::status(code_);
+    if(status && !status->page.empty()) {
+        path_ = status->page;
+        stat_();
+    } else if(code_ >= 400) {
+        // no page for this code, addContent_ falls back to errorContent
+        path_.clear();
+        mmFileStat_ = {0};
     }
 }
 
 void HttpResponse::addStateLine_(Buffer &buff) {
-    std::string status;
-    if(!CODE_STATUS.count(code_)) {
+    const HttpTables::Status *status = HttpTables::status(code_);
+    if(!status) {
         code_ = 400;
+        status = HttpTables::status(code_);
     }
-    status = CODE_STATUS.find(code_)->second;
-    buff.append("HTTP/1.1 " + std::to_string(code_) + " " + status + "\r\n");
+    buff.append(status->line.data(), status->line.size());
 }
 
-void HttpResponse::addHeader_(Buffer &buff) {
+void HttpResponse::addHeader_(Buffer &buff, std::string_view type) {
     buff.append("Connection: ");
     if(isKeepAlive_) {
         buff.append("keep-alive\r\n");
@@ -108,45 +114,54 @@ void HttpResponse::addHeader_(Buffer &buff) {
     } else {
         buff.append("close\r\n");
     }
-    buff.append("Content-type: " + getFileType_() + "\r\n");
+    buff.append("Content-type: ", 14);
+    buff.append(type.data(), type.size());
+    buff.append("\r\n", 2);
 }
 
 void HttpResponse::addContent_(Buffer &buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) {
-        errorContent(buff, "File Not Found");
+    if(path_.empty()) {
+        errorContent(buff, std::string(HttpTables::status(code_)->reason()));
+        return ;
+    }
+    if(file_ && file_->inlined) {
+        // small, after the header in one buffer: no mapping
+        buff.append("Content-length: " + std::to_string(file_->data.size()) + "\r\n\r\n");
+        buff.append(file_->data.data(), file_->data.size());
+        file_.reset();
         return ;
     }
-    // map files to memory to improve file access speed.
-    // MAP_PRIVATE creates a cow private mapping
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
+    if(!file_ || !S_ISREG(file_->st.st_mode)) {
         errorContent(buff, "File Not Found");
         return ;
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.append("Content-length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");    
+    LOG_DEBUG("file path %s", path_.c_str());
+    if(mmFileStat_.st_size == 0 || !file_->map) {
+        file_.reset();
+        buff.append("Content-length: 0\r\n\r\n");
+        return ;
+    }
+    // the mapping of the cache entry, held until the response is sent
+    mmFile_ = static_cast<char*>(file_->map);
+    buff.append("Content-length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
 
 void HttpResponse::unmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
+    mmFile_ = nullptr;
 }
 
-std::string HttpResponse::getFileType_() {
+std::string_view HttpResponse::getFileType_() const {
+    if(path_.empty()) {
+        // errorContent
+        return "text/html";
+    }
     std::string::size_type idx = path_.find_last_of('.');
     if(idx == std::string::npos) {
         return "text/plain";
     }
-    std::string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix)) {
-        return SUFFIX_TYPE.find(suffix)->second;
-    } 
-    return "text/plain";
+    std::string_view type = HttpTables::mimeType(std::string_view(path_).substr(idx + 1));
+    return type.empty() ? "text/plain" : type;
 }
 
 void HttpResponse::errorContent(Buffer &buff, std::string message) {
@@ -154,8 +169,8 @@ void HttpResponse::errorContent(Buffer &buff, std::string message) {
     std::string status;
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_)) {
-        status = CODE_STATUS.find(code_)->second;
+    if(const HttpTables::Status *known = HttpTables::status(code_)) {
+        status = known->reason();
     } else {
         status = "Bad Request";
     }
@@ -9,14 +9,21 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "httptables.h"
+#include "errorpages.h"
+#include "../cache/filecache.h"
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void init(const std::string &srcDir, std::string &path, bool isKeepAlive = false, int code = -1);
+    // path is the request's, resolved under the FileCache root
+    void init(std::string &path, bool isKeepAlive = false, int code = -1);
     void makeResponse(Buffer &buff);
+    // 200 with an in-memory body instead of a file
+    void makeResponse(Buffer &buff, const std::string &body, const std::string &type);
     void unmapFile();
     char* file();
     size_t fileLen() const;
@@ -24,25 +31,26 @@ public:
     int code() const {
         return code_;
     }
+    bool isKeepAlive() const {
+        return isKeepAlive_;
+    }
 
 private:
     void addStateLine_(Buffer &buff);
-    void addHeader_(Buffer &buff);
+    void addHeader_(Buffer &buff, std::string_view type);
     void addContent_(Buffer &buff);
 
+    int stat_();    // path_ into file_ and mmFileStat_, 0 or an errno
     void errorHtml_();
-    std::string getFileType_();
+    std::string_view getFileType_() const;
 
 private:
     int code_;
     bool isKeepAlive_;
     std::string path_;
-    std::string srcDir_;
+    std::shared_ptr<const FileCache::Entry> file_;  // until sent, owns mmFile_
     char* mmFile_;
     struct stat mmFileStat_;
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE; // suffix type set
-    static const std::unordered_map<int, std::string> CODE_STATUS; // code status set
-    static const std::unordered_map<int, std::string> CODE_PATH; // code path set
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#ifndef HTTP_TABLES_H
+#define HTTP_TABLES_H
+
+#include <array>
+#include <string_view>
+#include <stdint.h>
+
+// MIME types by file suffix and status lines by code, built by the
+// compiler: a lookup is a hash or an index and one compare, no
+// allocation. The suffix table is a perfect hash, its seed is searched
+// at compile time until no two suffixes share a slot.
+namespace HttpTables {
+
+struct Mime {
+    std::string_view suffix;    // lowercase, without the dot
+    std::string_view type;
+};
+
+inline constexpr Mime MIME[] = {
+    // text
+    {"html", "text/html"}, {"htm", "text/html"}, {"shtml", "text/html"},
+    {"css", "text/css"}, {"js", "text/javascript"}, {"mjs", "text/javascript"},
+    {"txt", "text/plain"}, {"text", "text/plain"}, {"log", "text/plain"},
+    {"csv", "text/csv"}, {"md", "text/markdown"}, {"xml", "text/xml"},
+    {"ics", "text/calendar"}, {"vtt", "text/vtt"}, {"rtx", "text/richtext"},
+    // application
+    {"json", "application/json"}, {"map", "application/json"},
+    {"jsonld", "application/ld+json"}, {"webmanifest", "application/manifest+json"},
+    {"xhtml", "application/xhtml+xml"}, {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"}, {"wasm", "application/wasm"},
+    {"rtf", "application/rtf"}, {"pdf", "application/pdf"},
+    {"doc", "application/msword"}, {"word", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"odt", "application/vnd.oasis.opendocument.text"},
+    {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    {"odp", "application/vnd.oasis.opendocument.presentation"},
+    {"epub", "application/epub+zip"}, {"swf", "application/x-shockwave-flash"},
+    {"gz", "application/x-gzip"}, {"tgz", "application/x-gzip"},
+    {"tar", "application/x-tar"}, {"zip", "application/zip"},
+    {"bz2", "application/x-bzip2"}, {"xz", "application/x-xz"},
+    {"zst", "application/zstd"}, {"7z", "application/x-7z-compressed"},
+    {"rar", "application/vnd.rar"}, {"jar", "application/java-archive"},
+    {"apk", "application/vnd.android.package-archive"},
+    {"deb", "application/vnd.debian.binary-package"},
+    {"rpm", "application/x-rpm"}, {"iso", "application/x-iso9660-image"},
+    {"dmg", "application/x-apple-diskimage"},
+    {"bin", "application/octet-stream"}, {"exe", "application/octet-stream"},
+    {"dll", "application/octet-stream"}, {"so", "application/octet-stream"},
+    {"wgz", "application/octet-stream"}, {"sh", "application/x-sh"},
+    {"pem", "application/x-pem-file"}, {"crt", "application/x-x509-ca-cert"},
+    // images
+    {"png", "image/png"}, {"gif", "image/gif"}, {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"}, {"jpe", "image/jpeg"}, {"bmp", "image/bmp"},
+    {"ico", "image/x-icon"}, {"svg", "image/svg+xml"}, {"svgz", "image/svg+xml"},
+    {"webp", "image/webp"}, {"avif", "image/avif"}, {"heic", "image/heic"},
+    {"tif", "image/tiff"}, {"tiff", "image/tiff"}, {"apng", "image/apng"},
+    // audio
+    {"au", "audio/basic"}, {"snd", "audio/basic"}, {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"}, {"ogg", "audio/ogg"}, {"oga", "audio/ogg"},
+    {"opus", "audio/opus"}, {"flac", "audio/flac"}, {"aac", "audio/aac"},
+    {"m4a", "audio/mp4"}, {"mid", "audio/midi"}, {"midi", "audio/midi"},
+    {"weba", "audio/webm"},
+    // video
+    {"mp4", "video/mp4"}, {"m4v", "video/mp4"}, {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"}, {"webm", "video/webm"}, {"ogv", "video/ogg"},
+    {"avi", "video/x-msvideo"}, {"mov", "video/quicktime"},
+    {"mkv", "video/x-matroska"}, {"flv", "video/x-flv"},
+    {"3gp", "video/3gpp"}, {"ts", "video/mp2t"}, {"m3u8", "application/vnd.apple.mpegurl"},
+    // fonts
+    {"woff", "font/woff"}, {"woff2", "font/woff2"}, {"ttf", "font/ttf"},
+    {"otf", "font/otf"}, {"eot", "application/vnd.ms-fontobject"},
+};
+
+inline constexpr size_t MIME_COUNT = sizeof(MIME) / sizeof(MIME[0]);
+inline constexpr size_t MIME_SLOTS = 1024;
+static_assert(MIME_COUNT < 255, "a slot is a uint8_t");
+
+constexpr char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+}
+
+// FNV-1a of the lowercased key, seeded
+constexpr uint32_t hash(uint32_t seed, std::string_view key) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for(char ch : key) {
+        h ^= static_cast<unsigned char>(lower(ch));
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+constexpr uint32_t mimeSeed() {
+    for(uint32_t seed = 1; seed < 100000; seed++) {
+        std::array<bool, MIME_SLOTS> used{};
+        bool perfect = true;
+        for(size_t i = 0; i < MIME_COUNT && perfect; i++) {
+            bool &slot = used[hash(seed, MIME[i].suffix) & (MIME_SLOTS - 1)];
+            perfect = !slot;
+            slot = true;
+        }
+        if(perfect) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+inline constexpr uint32_t MIME_SEED = mimeSeed();
+static_assert(MIME_SEED != 0, "no perfect seed, grow MIME_SLOTS");
+
+// slot -> index into MIME plus one, 0: empty
+inline constexpr std::array<uint8_t, MIME_SLOTS> MIME_SLOT = [] {
+    std::array<uint8_t, MIME_SLOTS> slots{};
+    for(size_t i = 0; i < MIME_COUNT; i++) {
+        slots[hash(MIME_SEED, MIME[i].suffix) & (MIME_SLOTS - 1)] = static_cast<uint8_t>(i + 1);
+    }
+    return slots;
+}();
+
+constexpr bool equalsNoCase(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(lower(a[i]) != lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// type of a suffix like "html" or "HTML", empty if unknown
+constexpr std::string_view mimeType(std::string_view suffix) {
+    uint8_t i = MIME_SLOT[hash(MIME_SEED, suffix) & (MIME_SLOTS - 1)];
+    if(i == 0 || !equalsNoCase(MIME[i - 1].suffix, suffix)) {
+        return std::string_view();
+    }
+    return MIME[i - 1].type;
+}
+
+struct Status {
+    int code;
+    std::string_view line;      // "HTTP/1.1 NNN Reason\r\n"
+    std::string_view page;      // under srcDir, empty: a generated body
+
+    constexpr std::string_view reason() const {
+        // between "HTTP/1.1 NNN " and "\r\n"
+        return line.substr(13, line.size() - 15);
+    }
+};
+
+inline constexpr Status STATUS[] = {
+    {100, "HTTP/1.1 100 Continue\r\n", ""},
+    {101, "HTTP/1.1 101 Switching Protocols\r\n", ""},
+    {102, "HTTP/1.1 102 Processing\r\n", ""},
+    {103, "HTTP/1.1 103 Early Hints\r\n", ""},
+    {200, "HTTP/1.1 200 OK\r\n", ""},
+    {201, "HTTP/1.1 201 Created\r\n", ""},
+    {202, "HTTP/1.1 202 Accepted\r\n", ""},
+    {203, "HTTP/1.1 203 Non-Authoritative Information\r\n", ""},
+    {204, "HTTP/1.1 204 No Content\r\n", ""},
+    {205, "HTTP/1.1 205 Reset Content\r\n", ""},
+    {206, "HTTP/1.1 206 Partial Content\r\n", ""},
+    {207, "HTTP/1.1 207 Multi-Status\r\n", ""},
+    {208, "HTTP/1.1 208 Already Reported\r\n", ""},
+    {226, "HTTP/1.1 226 IM Used\r\n", ""},
+    {300, "HTTP/1.1 300 Multiple Choices\r\n", ""},
+    {301, "HTTP/1.1 301 Moved Permanently\r\n", ""},
+    {302, "HTTP/1.1 302 Found\r\n", ""},
+    {303, "HTTP/1.1 303 See Other\r\n", ""},
+    {304, "HTTP/1.1 304 Not Modified\r\n", ""},
+    {305, "HTTP/1.1 305 Use Proxy\r\n", ""},
+    {307, "HTTP/1.1 307 Temporary Redirect\r\n", ""},
+    {308, "HTTP/1.1 308 Permanent Redirect\r\n", ""},
+    {400, "HTTP/1.1 400 Bad Request\r\n", "/400.html"},
+    {401, "HTTP/1.1 401 Unauthorized\r\n", ""},
+    {402, "HTTP/1.1 402 Payment Required\r\n", ""},
+    {403, "HTTP/1.1 403 Forbidden\r\n", "/403.html"},
+    {404, "HTTP/1.1 404 Not Found\r\n", "/404.html"},
+    {405, "HTTP/1.1 405 Method Not Allowed\r\n", "/405.html"},
+    {406, "HTTP/1.1 406 Not Acceptable\r\n", ""},
+    {407, "HTTP/1.1 407 Proxy Authentication Required\r\n", ""},
+    {408, "HTTP/1.1 408 Request Timeout\r\n", ""},
+    {409, "HTTP/1.1 409 Conflict\r\n", ""},
+    {410, "HTTP/1.1 410 Gone\r\n", ""},
+    {411, "HTTP/1.1 411 Length Required\r\n", ""},
+    {412, "HTTP/1.1 412 Precondition Failed\r\n", ""},
+    {413, "HTTP/1.1 413 Payload Too Large\r\n", ""},
+    {414, "HTTP/1.1 414 URI Too Long\r\n", ""},
+    {415, "HTTP/1.1 415 Unsupported Media Type\r\n", ""},
+    {416, "HTTP/1.1 416 Range Not Satisfiable\r\n", ""},
+    {417, "HTTP/1.1 417 Expectation Failed\r\n", ""},
+    {418, "HTTP/1.1 418 I'm a teapot\r\n", ""},
+    {421, "HTTP/1.1 421 Misdirected Request\r\n", ""},
+    {422, "HTTP/1.1 422 Unprocessable Content\r\n", ""},
+    {423, "HTTP/1.1 423 Locked\r\n", ""},
+    {424, "HTTP/1.1 424 Failed Dependency\r\n", ""},
+    {425, "HTTP/1.1 425 Too Early\r\n", ""},
+    {426, "HTTP/1.1 426 Upgrade Required\r\n", ""},
+    {428, "HTTP/1.1 428 Precondition Required\r\n", ""},
+    {429, "HTTP/1.1 429 Too Many Requests\r\n", ""},
+    {431, "HTTP/1.1 431 Request Header Fields Too Large\r\n", ""},
+    {451, "HTTP/1.1 451 Unavailable For Legal Reasons\r\n", ""},
+    {500, "HTTP/1.1 500 Internal Server Error\r\n", "/500.html"},
+    {501, "HTTP/1.1 501 Not Implemented\r\n", ""},
+    {502, "HTTP/1.1 502 Bad Gateway\r\n", ""},
+    {503, "HTTP/1.1 503 Service Unavailable\r\n", "/503.html"},
+    {504, "HTTP/1.1 504 Gateway Timeout\r\n", ""},
+    {505, "HTTP/1.1 505 HTTP Version Not Supported\r\n", ""},
+    {506, "HTTP/1.1 506 Variant Also Negotiates\r\n", ""},
+    {507, "HTTP/1.1 507 Insufficient Storage\r\n", ""},
+    {508, "HTTP/1.1 508 Loop Detected\r\n", ""},
+    {510, "HTTP/1.1 510 Not Extended\r\n", ""},
+    {511, "HTTP/1.1 511 Network Authentication Required\r\n", ""},
+};
+
+inline constexpr size_t STATUS_COUNT = sizeof(STATUS) / sizeof(STATUS[0]);
+inline constexpr int STATUS_MIN = 100;
+inline constexpr int STATUS_MAX = 599;
+
+// the code is the hash: code - 100 -> index into STATUS plus one, 0: none
+inline constexpr std::array<uint8_t, STATUS_MAX - STATUS_MIN + 1> STATUS_SLOT = [] {
+    std::array<uint8_t, STATUS_MAX - STATUS_MIN + 1> slots{};
+    for(size_t i = 0; i < STATUS_COUNT; i++) {
+        slots[STATUS[i].code - STATUS_MIN] = static_cast<uint8_t>(i + 1);
+    }
+    return slots;
+}();
+
+// nullptr: not a standard code
+constexpr const Status *status(int code) {
+    if(code < STATUS_MIN || code > STATUS_MAX || STATUS_SLOT[code - STATUS_MIN] == 0) {
+        return nullptr;
+    }
+    return &STATUS[STATUS_SLOT[code - STATUS_MIN] - 1];
+}
+
+static_assert(mimeType("css") == "text/css" && mimeType("HTML") == "text/html" && mimeType("nope").empty());
+static_assert(status(304)->reason() == "Not Modified" && status(503)->line.size() == 34 && !status(299));
+
+} // namespace HttpTables
+
+#endif
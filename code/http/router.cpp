@@ -0,0 +1,285 @@
+#include "router.h"
+
+#include <string.h>
+#include <algorithm>
+
+std::string_view Router::Params::get(std::string_view name) const {
+    for(int i = 0; i < cnt_; i++) {
+        if(names_[i] == name) {
+            return values_[i];
+        }
+    }
+    return std::string_view();
+}
+
+Router *Router::instance() {
+    static Router router;
+    return &router;
+}
+
+Router::METHOD Router::parseMethod(std::string_view method) {
+    static const char *const NAME[ANY] = {"GET", "HEAD", "POST", "PUT", "DELETE"};
+    for(int i = 0; i < ANY; i++) {
+        if(method == NAME[i]) {
+            return static_cast<METHOD>(i);
+        }
+    }
+    return METHOD_COUNT;
+}
+
+void Router::clear() {
+    handlers_.clear();
+    static_.clear();
+    slots_.clear();
+    seed_ = 0;
+    nodes_.clear();
+    newNode_("");
+}
+
+bool Router::add(const char *method, const std::string &pattern, Handler handler, std::string *err) {
+    METHOD m = strcmp(method, "*") == 0 ? ANY : parseMethod(method);
+    const char *error = nullptr;
+    if(m == METHOD_COUNT) {
+        error = "unknown method";
+    } else if(pattern.empty() || pattern[0] != '/') {
+        error = "a pattern starts with /";
+    } else if(!handler) {
+        error = "no handler";
+    }
+    // ":name" and "*name" take a whole segment, "*name" the last one
+    int captures = 0;
+    for(size_t i = 0; i < pattern.size() && !error; i++) {
+        char ch = pattern[i];
+        if(ch != ':' && ch != '*') {
+            continue;
+        }
+        size_t end = std::min(pattern.find('/', i), pattern.size());
+        if(pattern[i - 1] != '/' || end == i + 1) {
+            error = "a capture is a whole named segment";
+        } else if(ch == '*' && end != pattern.size()) {
+            error = "*name is the last segment";
+        } else if(++captures > Params::MAX) {
+            error = "too many captures";
+        } else if(std::find_if(pattern.begin() + i + 1, pattern.begin() + end,
+                               [](char c) { return c == ':' || c == '*'; }) != pattern.begin() + end) {
+            error = "a capture name has no : or *";
+        }
+        i = end;
+    }
+    if(error) {
+        LOG_ERROR("Route %s %s: %s", method, pattern.c_str(), error);
+        if(err) {
+            *err = error;
+        }
+        return false;
+    }
+
+    int *slot;
+    if(captures == 0) {
+        auto it = std::find_if(static_.begin(), static_.end(),
+                               [&pattern](const StaticRoute &route) { return route.path == pattern; });
+        if(it == static_.end()) {
+            static_.push_back(StaticRoute());
+            it = static_.end() - 1;
+            it->path = pattern;
+            std::fill(it->handlers, it->handlers + METHOD_COUNT, -1);
+        }
+        slot = &it->handlers[m];
+    } else {
+        int node = 0;
+        std::string_view rest(pattern);
+        while(!rest.empty()) {
+            if(rest[0] != ':' && rest[0] != '*') {
+                size_t end = std::min(rest.find_first_of(":*"), rest.size());
+                node = insertStatic_(node, rest.substr(0, end));
+                rest.remove_prefix(end);
+                continue;
+            }
+            size_t end = std::min(rest.find('/'), rest.size());
+            std::string name(rest.substr(1, end - 1));
+            bool isParam = rest[0] == ':';
+            int child = isParam ? nodes_[node].param : nodes_[node].wild;
+            if(child < 0) {
+                child = newNode_("");
+                nodes_[child].name = name;
+                (isParam ? nodes_[node].param : nodes_[node].wild) = child;
+            } else if(nodes_[child].name != name) {
+                // one capture per position, whatever the route
+                LOG_ERROR("Route %s %s: %s is already named %s", method, pattern.c_str(),
+                          name.c_str(), nodes_[child].name.c_str());
+                if(err) {
+                    *err = "capture named differently by another route";
+                }
+                return false;
+            }
+            node = child;
+            rest.remove_prefix(end);
+        }
+        slot = &nodes_[node].handlers[m];
+    }
+    if(*slot >= 0) {
+        handlers_[*slot] = std::move(handler);
+    } else {
+        *slot = static_cast<int>(handlers_.size());
+        handlers_.push_back(std::move(handler));
+    }
+    if(captures == 0) {
+        buildHash_();
+    }
+    LOG_DEBUG("Route %s %s", method, pattern.c_str());
+    return true;
+}
+
+int Router::newNode_(const std::string &prefix) {
+    nodes_.push_back(Node());
+    Node &node = nodes_.back();
+    node.prefix = prefix;
+    node.param = node.wild = -1;
+    std::fill(node.handlers, node.handlers + METHOD_COUNT, -1);
+    return static_cast<int>(nodes_.size()) - 1;
+}
+
+// the node at the end of text below node, edges are split where they part
+int Router::insertStatic_(int node, std::string_view text) {
+    while(!text.empty()) {
+        size_t pos = nodes_[node].first.find(text[0]);
+        if(pos == std::string::npos) {
+            int child = newNode_(std::string(text));
+            nodes_[node].first += text[0];
+            nodes_[node].children.push_back(child);
+            return child;
+        }
+        int child = nodes_[node].children[pos];
+        std::string prefix = nodes_[child].prefix;
+        size_t common = 0;
+        while(common < prefix.size() && common < text.size() && prefix[common] == text[common]) {
+            common++;
+        }
+        if(common < prefix.size()) {
+            int mid = newNode_(prefix.substr(0, common));
+            nodes_[child].prefix = prefix.substr(common);
+            nodes_[mid].first = prefix.substr(common, 1);
+            nodes_[mid].children.push_back(child);
+            nodes_[node].children[pos] = mid;
+            child = mid;
+        }
+        node = child;
+        text.remove_prefix(common);
+    }
+    return node;
+}
+
+int Router::handlerFor_(const int *handlers, METHOD method) {
+    if(method < ANY && handlers[method] >= 0) {
+        return handlers[method];
+    }
+    return handlers[ANY];
+}
+
+// rest is the path below node; backtracks when a static edge fits but
+// leads nowhere
+bool Router::match_(int idx, std::string_view rest, METHOD method, Params *params, int *handler) const {
+    const Node &node = nodes_[idx];
+    if(rest.empty()) {
+        int h = handlerFor_(node.handlers, method);
+        if(h >= 0) {
+            *handler = h;
+            return true;
+        }
+    } else {
+        size_t pos = node.first.find(rest[0]);
+        if(pos != std::string::npos) {
+            int child = node.children[pos];
+            const std::string &prefix = nodes_[child].prefix;
+            if(rest.starts_with(prefix) && match_(child, rest.substr(prefix.size()), method, params, handler)) {
+                return true;
+            }
+        }
+        if(node.param >= 0 && rest[0] != '/') {
+            size_t end = std::min(rest.find('/'), rest.size());
+            int cnt = params->cnt_;
+            params->names_[cnt] = nodes_[node.param].name;
+            params->values_[cnt] = rest.substr(0, end);
+            params->cnt_++;
+            if(match_(node.param, rest.substr(end), method, params, handler)) {
+                return true;
+            }
+            params->cnt_ = cnt;
+        }
+    }
+    if(node.wild >= 0) {
+        int h = handlerFor_(nodes_[node.wild].handlers, method);
+        if(h >= 0) {
+            params->names_[params->cnt_] = nodes_[node.wild].name;
+            params->values_[params->cnt_] = rest;
+            params->cnt_++;
+            *handler = h;
+            return true;
+        }
+    }
+    return false;
+}
+
+const Router::Handler *Router::match(const std::string &method, std::string_view path, Params *params) const {
+    METHOD m = parseMethod(method);
+    path = path.substr(0, path.find('?'));
+    params->cnt_ = 0;
+    if(!slots_.empty()) {
+        int i = slots_[hash_(seed_, path) & (slots_.size() - 1)];
+        if(i >= 0 && static_[i].path == path) {
+            int h = handlerFor_(static_[i].handlers, m);
+            if(h >= 0) {
+                return &handlers_[h];
+            }
+        }
+    }
+    int h;
+    if(nodes_.size() > 1 && match_(0, path, m, params, &h)) {
+        return &handlers_[h];
+    }
+    return nullptr;
+}
+
+bool Router::dispatch(HttpRequest &request, Reply *reply) const {
+    Params params;
+    const Handler *handler = match(request.method(), request.path(), &params);
+    if(!handler) {
+        return false;
+    }
+    (*handler)(request, params, reply);
+    return true;
+}
+
+// FNV-1a, seeded
+uint32_t Router::hash_(uint32_t seed, std::string_view key) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for(char ch : key) {
+        h ^= static_cast<unsigned char>(ch);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+// a table twice the routes or more and the first seed that puts no two
+// static paths in one slot: a lookup is one hash and one compare
+void Router::buildHash_() {
+    size_t size = 8;
+    while(size < static_.size() * 2) {
+        size <<= 1;
+    }
+    for(;; size <<= 1) {
+        for(uint32_t seed = 1; seed <= 64; seed++) {
+            slots_.assign(size, -1);
+            bool perfect = true;
+            for(size_t i = 0; i < static_.size() && perfect; i++) {
+                int &slot = slots_[hash_(seed, static_[i].path) & (size - 1)];
+                perfect = slot < 0;
+                slot = static_cast<int>(i);
+            }
+            if(perfect) {
+                seed_ = seed;
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include "httprequest.h"
+
+// Maps a method and a path to a handler; a request no route takes is
+// served from the filesystem. A pattern is static, "/login", or has
+// ":name" segments, matching one path segment, and a last "*name",
+// matching the rest of the path. Static routes are one probe of a
+// perfect hash, the others a walk down a radix trie, static edges tried
+// before ":name" before "*name". The query string is not matched.
+// Routes are added before the server starts, lookups take no lock.
+class Router {
+public:
+    enum METHOD {
+        GET,
+        HEAD,
+        POST,
+        PUT,
+        DELETE,
+        ANY,    // "*", taken when the method has no route of its own
+        METHOD_COUNT,
+    };
+
+    // the captures of a match, views into the request path: valid until
+    // the handler changes request.path()
+    class Params {
+    public:
+        Params() : cnt_(0) {}
+        // empty if absent
+        std::string_view get(std::string_view name) const;
+        int size() const {
+            return cnt_;
+        }
+    private:
+        friend class Router;
+        static const int MAX = 8;
+        std::string_view names_[MAX];
+        std::string_view values_[MAX];
+        int cnt_;
+    };
+
+    // what the handler answers; type left empty: the file at
+    // request.path() is served, the handler may have rewritten it
+    struct Reply {
+        std::string body;
+        std::string type;
+        void clear() {
+            body.clear();
+            type.clear();
+        }
+    };
+
+    typedef std::function<void(HttpRequest &request, const Params &params, Reply *reply)> Handler;
+
+    static Router *instance();
+
+    // method is "GET", "HEAD", "POST", "PUT", "DELETE" or "*";
+    // an equal route is replaced
+    bool add(const char *method, const std::string &pattern, Handler handler, std::string *err = nullptr);
+    void clear();
+
+    // runs the handler of the request's route, false: no route
+    bool dispatch(HttpRequest &request, Reply *reply) const;
+    // nullptr: no route
+    const Handler *match(const std::string &method, std::string_view path, Params *params) const;
+
+    static METHOD parseMethod(std::string_view method);    // METHOD_COUNT: unknown
+
+private:
+    Router() {
+        clear();
+    }
+
+    struct StaticRoute {
+        std::string path;
+        int handlers[METHOD_COUNT];     // into handlers_, -1: none
+    };
+
+    struct Node {
+        std::string prefix;     // bytes of the edge into the node, empty below ":" and "*"
+        std::string first;      // first byte of each static child
+        std::vector<int> children;
+        int param;              // ":name" child, -1: none
+        int wild;               // "*name" child
+        std::string name;       // the capture, on ":" and "*" nodes
+        int handlers[METHOD_COUNT];
+    };
+
+    int newNode_(const std::string &prefix);
+    int insertStatic_(int node, std::string_view text);
+    bool match_(int node, std::string_view rest, METHOD method, Params *params, int *handler) const;
+    static int handlerFor_(const int *handlers, METHOD method);
+
+    void buildHash_();
+    static uint32_t hash_(uint32_t seed, std::string_view key);
+
+    std::vector<Handler> handlers_;
+    std::vector<StaticRoute> static_;
+    // slot -> index into static_, -1: empty; no two paths share a slot
+    std::vector<int> slots_;
+    uint32_t seed_;
+    std::vector<Node> nodes_;   // nodes_[0] is the root, "/"
+};
+
+#endif
@@ -48,8 +48,11 @@ BlockQueue<T>::~BlockQueue() {
 
 template<typename T>
 void BlockQueue<T>::close() {
-    clear();
-    isClose_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        deq_.clear();
+        isClose_ = true;
+    }
     condConsumer_.notify_all();
     condProducer_.notify_all();
 }
@@ -97,6 +100,9 @@ template<typename T>
 bool BlockQueue<T>::pop(T &item) {
     std::unique_lock<std::mutex> lock(mtx_);
     while(deq_.empty()) {
+        if(isClose_) {
+            return false;
+        }
         condConsumer_.wait(lock);
     }
     item = std::move(deq_.front());
@@ -10,11 +10,14 @@ Log::Log() {
 }
 
 Log::~Log() {
-    while(!deque_->empty()) {
-        deque_->flush();
+    // synchronous logs have no queue
+    if(deque_) {
+        while(!deque_->empty()) {
+            deque_->flush();
+        }
+        deque_->close();
+        writeThread_->join();
     }
-    deque_->close();
-    writeThread_->join(); 
     {
         std::lock_guard<std::mutex> lock(mtx_);
         if(fp_) {
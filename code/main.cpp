@@ -1,5 +1,6 @@
 #include <unistd.h>
 #include "server/webserver.h"
+#include "server/master.h"
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -42,24 +43,29 @@ int init_daemon(void)
 
 
 int main(int argc, char* argv[]) {
-	int port = 5423;
-	if(argc > 3) {
-		std::cerr << "webserver argument error" << std::endl;
+	// defaults < config file (-f) < command line
+	Config config;
+	bool printConfig = false;
+	std::string err;
+	if(!config.parseArgs(argc, argv, &printConfig, &err) || !config.validate(&err)) {
+		std::cerr << "webserver: " << err << std::endl;
+		std::cerr << "usage: server [-f file] [--key value | --key=value]... [--print-config]"
+				  << std::endl;
+		return 1;
 	}
-	for(int i = 1; i < argc; i += 2) {
-		if(strcmp(argv[i], "-p") == 0) {
-			sscanf(argv[i + 1], "%d", &port);
-		}
+	if(printConfig) {
+		std::cout << config.dump();
+		return 0;
 	}
     // if(init_daemon() < 0) {
 	// 	std::cout << "init_daemon error" << std::endl;
 	// }
-	std::cout << "server run at port[" << port << "]" << std::endl;
-    WebServer server(
-        port, 3, 60000, false,
-        3307, "root", "root", "webserver",
-        12, 8, true, 1, 1024
-    );
+	std::cout << "server run at port[" << config.port << "]" << std::endl;
+	if(config.workers > 0) {
+		// prefork: this process only supervises the workers
+		return Master(config).run();
+	}
+    WebServer server(config);
     server.start();
     exit(0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,270 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <algorithm>
+#include <sys/mman.h>
+
+const int Metrics::STATUS_CODES[STATUS_NUM] = {
+    200, 206, 301, 302, 304, 400, 403, 404, 405, 413, 500, 503,
+};
+
+const char *const Metrics::COUNTER_NAME[COUNTER_NUM][2] = {
+    {"tws_accepts_total", "Accepted connections."},
+    {"tws_bytes_in_total", "Bytes read from clients."},
+    {"tws_bytes_out_total", "Bytes written to clients."},
+    {"tws_parse_errors_total", "Requests rejected by the parser."},
+    {"tws_timer_expirations_total", "Connections closed by the idle timer."},
+    {"tws_rejected_connections_total", "Connections answered 503 and closed at accept."},
+    {"tws_worker_restarts_total", "Worker processes respawned by the master."},
+};
+
+const char *const Metrics::SYSCALL_NAME[SYSCALL_NUM] = {
+    "wait", "ctl", "read", "write", "accept", "close", "fcntl", "sockopt", "file",
+};
+
+const char *const Metrics::PHASE_NAME[PHASE_NUM] = {
+    "parse", "process", "write",
+};
+
+Metrics *Metrics::instance() {
+    static Metrics metrics;
+    return &metrics;
+}
+
+Metrics::Slot *Metrics::register_() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(shared_ && process_ >= 0 && nextShared_ < sharedSlots_) {
+            // a respawned worker adds on top of its predecessor's counts
+            return &shared_[process_ * sharedSlots_ + nextShared_++];
+        }
+    }
+    // operator new does not honour alignas(64) before C++17
+    void *mem = aligned_alloc(alignof(Slot), sizeof(Slot));
+    assert(mem);
+    memset(mem, 0, sizeof(Slot));
+    Slot *slot = static_cast<Slot *>(mem);
+    std::lock_guard<std::mutex> lock(mtx_);
+    slots_.push_back(slot);
+    return slot;
+}
+
+void Metrics::addNumaAccept(int rxNode, bool local) {
+    int i = (rxNode >= 0 && rxNode < NUMA_NODES) ? rxNode : NUMA_NODES;
+    std::atomic<uint64_t> &c = local_()->numaAccepts[i][local ? 1 : 0];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Metrics::setNumaNodes(int n) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    numaNodes_ = std::min(n, static_cast<int>(NUMA_NODES));
+}
+
+bool Metrics::initShared(int processes, int slotsPerProcess) {
+    size_t size = sizeof(Slot) * processes * slotsPerProcess;
+    // anonymous pages come zeroed and page aligned
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    shared_ = static_cast<Slot *>(mem);
+    sharedProcs_ = processes;
+    sharedSlots_ = slotsPerProcess;
+    return true;
+}
+
+void Metrics::setProcess(int index) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    assert(shared_ && index >= 0 && index < sharedProcs_);
+    process_ = index;
+    nextShared_ = 0;
+    // private slots copied from the parent hold the parent's counts
+    slots_.clear();
+    gen_++;
+}
+
+void Metrics::addStatus(int code) {
+    int i = 0;
+    while(i < STATUS_NUM && STATUS_CODES[i] != code) {
+        i++;
+    }
+    std::atomic<uint64_t> &c = local_()->status[i];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Metrics::observe(PHASE phase, uint64_t us) {
+    Histogram &h = local_()->phases[phase];
+    std::atomic<uint64_t> &b = h.buckets[bucketIndex(us)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.sum.store(h.sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+}
+
+int Metrics::bucketIndex(uint64_t us) {
+    if(us < static_cast<uint64_t>(SUB_COUNT)) {
+        return static_cast<int>(us);
+    }
+    int msb = 63 - __builtin_clzll(us);
+    if(msb >= MAX_BITS) {
+        return BUCKET_NUM - 1;
+    }
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + static_cast<int>((us >> shift) - SUB_COUNT);
+}
+
+// largest value of the bucket, the last one is unbounded
+uint64_t Metrics::bucketUpper(int index) {
+    int group = index >> SUB_BITS;
+    if(group == 0) {
+        return index;
+    }
+    int shift = group - 1;
+    uint64_t sub = (index & (SUB_COUNT - 1)) + SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void Metrics::addGauge(const std::string &name, const std::string &help,
+                       const GaugeFun &fun, bool isCounter) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for(Gauge &gauge : gauges_) {
+        if(gauge.name == name) {
+            gauge.help = help;
+            gauge.fun = fun;
+            gauge.isCounter = isCounter;
+            return;
+        }
+    }
+    gauges_.push_back({name, help, fun, isCounter});
+}
+
+void Metrics::clearGauges() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    gauges_.clear();
+}
+
+static void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string &out, const char *format, ...) {
+    char line[256];
+    va_list vaList;
+    va_start(vaList, format);
+    int n = vsnprintf(line, sizeof(line), format, vaList);
+    va_end(vaList);
+    if(n > 0) {
+        out.append(line, std::min<size_t>(n, sizeof(line) - 1));
+    }
+}
+
+std::string Metrics::render() {
+    uint64_t counters[COUNTER_NUM] = {0};
+    uint64_t status[STATUS_NUM + 1] = {0};
+    uint64_t syscalls[SYSCALL_NUM] = {0};
+    uint64_t numa[NUMA_NODES + 1][2] = {{0}};
+    int numaNodes = 0;
+    std::vector<uint64_t> buckets(PHASE_NUM * BUCKET_NUM, 0);
+    uint64_t sums[PHASE_NUM] = {0};
+    std::vector<Gauge> gauges;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<const Slot *> slots(slots_.begin(), slots_.end());
+        for(int i = 0; i < sharedProcs_ * sharedSlots_; i++) {
+            slots.push_back(&shared_[i]);
+        }
+        for(const Slot *slot : slots) {
+            for(int i = 0; i < COUNTER_NUM; i++) {
+                counters[i] += slot->counters[i].load(std::memory_order_relaxed);
+            }
+            for(int i = 0; i <= STATUS_NUM; i++) {
+                status[i] += slot->status[i].load(std::memory_order_relaxed);
+            }
+            for(int i = 0; i < SYSCALL_NUM; i++) {
+                syscalls[i] += slot->syscalls[i].load(std::memory_order_relaxed);
+            }
+            for(int i = 0; i <= NUMA_NODES; i++) {
+                numa[i][0] += slot->numaAccepts[i][0].load(std::memory_order_relaxed);
+                numa[i][1] += slot->numaAccepts[i][1].load(std::memory_order_relaxed);
+            }
+            for(int p = 0; p < PHASE_NUM; p++) {
+                for(int i = 0; i < BUCKET_NUM; i++) {
+                    buckets[p * BUCKET_NUM + i] += slot->phases[p].buckets[i].load(std::memory_order_relaxed);
+                }
+                sums[p] += slot->phases[p].sum.load(std::memory_order_relaxed);
+            }
+        }
+        gauges = gauges_;
+        numaNodes = numaNodes_;
+    }
+
+    std::string out;
+    out.reserve(32768);
+    for(int i = 0; i < COUNTER_NUM; i++) {
+        appendf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                COUNTER_NAME[i][0], COUNTER_NAME[i][1], COUNTER_NAME[i][0],
+                COUNTER_NAME[i][0], static_cast<unsigned long long>(counters[i]));
+    }
+
+    out += "# HELP tws_requests_total Responses by status code.\n"
+           "# TYPE tws_requests_total counter\n";
+    for(int i = 0; i <= STATUS_NUM; i++) {
+        if(i < STATUS_NUM) {
+            appendf(out, "tws_requests_total{code=\"%d\"} %llu\n",
+                    STATUS_CODES[i], static_cast<unsigned long long>(status[i]));
+        } else {
+            appendf(out, "tws_requests_total{code=\"other\"} %llu\n",
+                    static_cast<unsigned long long>(status[i]));
+        }
+    }
+
+    out += "# HELP tws_syscalls_total Syscalls made for clients, by kind.\n"
+           "# TYPE tws_syscalls_total counter\n";
+    for(int i = 0; i < SYSCALL_NUM; i++) {
+        appendf(out, "tws_syscalls_total{call=\"%s\"} %llu\n",
+                SYSCALL_NAME[i], static_cast<unsigned long long>(syscalls[i]));
+    }
+
+    if(numaNodes > 0) {
+        out += "# HELP tws_numa_accepts_total Accepted connections by the NUMA node that received them"
+               " and whether the accepting thread runs there.\n"
+               "# TYPE tws_numa_accepts_total counter\n";
+        for(int i = 0; i <= NUMA_NODES; i++) {
+            if(i >= numaNodes && i < NUMA_NODES) {
+                continue;
+            }
+            char node[16];
+            snprintf(node, sizeof(node), i < NUMA_NODES ? "%d" : "unknown", i);
+            // an unknown node is never local
+            for(int local = i < NUMA_NODES ? 1 : 0; local >= 0; local--) {
+                appendf(out, "tws_numa_accepts_total{node=\"%s\",local=\"%s\"} %llu\n",
+                        node, local ? "true" : "false", static_cast<unsigned long long>(numa[i][local]));
+            }
+        }
+    }
+
+    out += "# HELP tws_phase_seconds Latency of the request phases.\n"
+           "# TYPE tws_phase_seconds histogram\n";
+    for(int p = 0; p < PHASE_NUM; p++) {
+        uint64_t cumulative = 0;
+        for(int i = 0; i < BUCKET_NUM - 1; i++) {
+            cumulative += buckets[p * BUCKET_NUM + i];
+            appendf(out, "tws_phase_seconds_bucket{phase=\"%s\",le=\"%.9g\"} %llu\n",
+                    PHASE_NAME[p], bucketUpper(i) / 1e6, static_cast<unsigned long long>(cumulative));
+        }
+        cumulative += buckets[p * BUCKET_NUM + BUCKET_NUM - 1];
+        appendf(out, "tws_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                PHASE_NAME[p], static_cast<unsigned long long>(cumulative));
+        appendf(out, "tws_phase_seconds_sum{phase=\"%s\"} %.6f\n", PHASE_NAME[p], sums[p] / 1e6);
+        appendf(out, "tws_phase_seconds_count{phase=\"%s\"} %llu\n",
+                PHASE_NAME[p], static_cast<unsigned long long>(cumulative));
+    }
+
+    for(const Gauge &gauge : gauges) {
+        appendf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n",
+                gauge.name.c_str(), gauge.help.c_str(), gauge.name.c_str(),
+                gauge.isCounter ? "counter" : "gauge", gauge.name.c_str(), gauge.fun());
+    }
+    return out;
+}
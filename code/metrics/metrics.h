@@ -0,0 +1,160 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+// Process wide counters and latency histograms, exported on /metrics in
+// the Prometheus text format.
+// Every thread writes its own cache-line aligned slot with relaxed
+// stores, nothing is shared on the hot path; a scrape sums the slots.
+// With prefork workers the slots live in memory shared by all processes,
+// any worker's scrape reports the sum of all of them.
+class Metrics {
+public:
+    enum COUNTER {
+        ACCEPTS,
+        BYTES_IN,
+        BYTES_OUT,
+        PARSE_ERRORS,
+        TIMER_EXPIRATIONS,
+        REJECTS,    // connections turned away by admission control
+        WORKER_RESTARTS,
+        COUNTER_NUM,
+    };
+
+    // syscalls made on behalf of clients, by kind
+    enum SYSCALL {
+        SYS_WAIT,   // epoll_wait, io_uring_enter that waits
+        SYS_CTL,    // epoll_ctl, io_uring_enter that only submits
+        SYS_READ,
+        SYS_WRITE,
+        SYS_ACCEPT,
+        SYS_CLOSE,
+        SYS_FCNTL,
+        SYS_SOCKOPT,
+        SYS_FILE,   // stat/open/mmap/munmap/close of served files
+        SYSCALL_NUM,
+    };
+
+    enum PHASE {
+        PARSE,      // HttpRequest::parse of a whole request
+        PROCESS,    // building the response, file lookup included
+        WRITE,      // response ready until its last byte is sent
+        PHASE_NUM,
+    };
+
+    // log-linear buckets in microseconds: 4 per power of two up to 2^26us
+    static const int SUB_BITS = 2;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 26;
+    static const int BUCKET_NUM = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT + 1;
+
+    typedef std::function<double()> GaugeFun;
+    typedef std::chrono::steady_clock Clock;
+
+    static Metrics *instance();
+
+    void add(COUNTER id, uint64_t n = 1) {
+        std::atomic<uint64_t> &c = local_()->counters[id];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void addStatus(int code);
+    void addSyscall(SYSCALL id, uint64_t n = 1) {
+        std::atomic<uint64_t> &c = local_()->syscalls[id];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void observe(PHASE phase, Clock::time_point start) {
+        observe(phase, std::chrono::duration_cast<std::chrono::microseconds>(
+                        Clock::now() - start).count());
+    }
+    void observe(PHASE phase, uint64_t us);
+    // rxNode: NUMA node whose cpu received the connection, -1: unknown;
+    // local: the accepting thread runs on it
+    void addNumaAccept(int rxNode, bool local);
+    // the per-node series are exported for nodes 0..n-1, 0: none
+    void setNumaNodes(int n);
+
+    // sampled on scrape, e.g. queue depths owned by other components;
+    // isCounter only changes the TYPE line
+    void addGauge(const std::string &name, const std::string &help,
+                  const GaugeFun &fun, bool isCounter = false);
+    void clearGauges();
+
+    // the whole exposition, in text format 0.0.4
+    std::string render();
+
+    // prefork: the master maps slots for all processes before forking,
+    // counts then outlive a worker and survive its respawn
+    bool initShared(int processes, int slotsPerProcess = 64);
+    // after fork, the process takes the range of its index
+    void setProcess(int index);
+
+    static int bucketIndex(uint64_t us);
+    static uint64_t bucketUpper(int index);
+
+private:
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKET_NUM];
+        std::atomic<uint64_t> sum;
+    };
+
+    // status codes with their own series, anything else is "other"
+    static const int STATUS_CODES[];
+    static const int STATUS_NUM = 12;
+    static const int NUMA_NODES = 8;    // higher node ids count as unknown
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        std::atomic<uint64_t> status[STATUS_NUM + 1];
+        std::atomic<uint64_t> syscalls[SYSCALL_NUM];
+        std::atomic<uint64_t> numaAccepts[NUMA_NODES + 1][2];    // [node][local]
+        Histogram phases[PHASE_NUM];
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string help;
+        GaugeFun fun;
+        bool isCounter;
+    };
+
+    Metrics() = default;
+    ~Metrics() = default;
+
+    Slot *local_() {
+        static thread_local Slot *slot = nullptr;
+        static thread_local uint32_t gen = 0;
+        // a forked child must not keep writing its parent's slot
+        if(!slot || gen != gen_) {
+            slot = register_();
+            gen = gen_;
+        }
+        return slot;
+    }
+    Slot *register_();
+
+    static const char *const COUNTER_NAME[COUNTER_NUM][2];
+    static const char *const PHASE_NAME[PHASE_NUM];
+    static const char *const SYSCALL_NAME[SYSCALL_NUM];
+
+    std::mutex mtx_;
+    // slots are never freed: a finished thread leaves its counts behind
+    std::vector<Slot *> slots_;
+    std::vector<Gauge> gauges_;
+    int numaNodes_ = 0;
+
+    Slot *shared_ = nullptr;
+    int sharedProcs_ = 0;
+    int sharedSlots_ = 0;   // per process
+    int process_ = -1;
+    int nextShared_ = 0;
+    uint32_t gen_ = 0;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "tracer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *const Tracer::SPAN_NAME[RequestTrace::SPAN_NUM] = {
+    "queue", "read", "parse", "lookup", "writev",
+};
+
+void RequestTrace::reset(int fd) {
+    this->fd = fd;
+    code = 0;
+    spanCnt = 0;
+    dropped = 0;
+    path[0] = '\0';
+}
+
+void RequestTrace::setPath(const std::string &p) {
+    size_t n = std::min(p.size(), sizeof(path) - 1);
+    for(size_t i = 0; i < n; i++) {
+        char ch = p[i];
+        path[i] = (ch < 0x20 || ch == 0x7f || ch == '"' || ch == '\\') ? '_' : ch;
+    }
+    path[n] = '\0';
+}
+
+Tracer *Tracer::instance() {
+    static Tracer tracer;
+    return &tracer;
+}
+
+void Tracer::init(int sampleEvery, size_t ringSize) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    sampleEvery_ = sampleEvery > 0 ? sampleEvery : 0;
+    ring_.assign(sampleEvery > 0 ? ringSize : 0, RequestTrace());
+    next_ = 0;
+    count_ = 0;
+    baseTick_ = now();
+    baseTime_ = std::chrono::steady_clock::now();
+}
+
+void Tracer::submit(const RequestTrace &trace) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if(ring_.empty()) {
+        return;
+    }
+    ring_[next_] = trace;
+    next_ = (next_ + 1) % ring_.size();
+    count_++;
+}
+
+std::string Tracer::exportChrome() {
+    std::vector<RequestTrace> traces;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        // oldest first
+        size_t n = std::min<uint64_t>(count_, ring_.size());
+        size_t first = (next_ + ring_.size() - n) % (ring_.empty() ? 1 : ring_.size());
+        for(size_t i = 0; i < n; i++) {
+            traces.push_back(ring_[(first + i) % ring_.size()]);
+        }
+    }
+    double us = std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(
+                    std::chrono::steady_clock::now() - baseTime_).count();
+    uint64_t ticks = now() - baseTick_;
+    double ticksPerUs = (us > 0 && ticks > 0) ? ticks / us : 1;
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    char event[512];
+    bool first = true;
+    int pid = getpid();
+    for(const RequestTrace &trace : traces) {
+        if(trace.spanCnt == 0) {
+            continue;
+        }
+        uint64_t begin = trace.spans[0].start;
+        uint64_t end = trace.spans[0].end;
+        for(uint32_t i = 0; i < trace.spanCnt; i++) {
+            begin = std::min(begin, trace.spans[i].start);
+            end = std::max(end, trace.spans[i].end);
+        }
+        // the whole request, then its spans nested below it
+        snprintf(event, sizeof(event),
+                 "%s{\"name\":\"request\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"path\":\"%s\",\"code\":%d,\"dropped\":%u}}",
+                 first ? "" : ",", pid, trace.fd, (begin - baseTick_) / ticksPerUs,
+                 (end - begin) / ticksPerUs, trace.path, trace.code, trace.dropped);
+        out += event;
+        first = false;
+        for(uint32_t i = 0; i < trace.spanCnt; i++) {
+            const RequestTrace::Span &span = trace.spans[i];
+            snprintf(event, sizeof(event),
+                     ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                     "\"args\":{\"bytes\":%u}}",
+                     SPAN_NAME[span.type], pid, trace.fd, (span.start - baseTick_) / ticksPerUs,
+                     (span.end - span.start) / ticksPerUs, span.arg);
+            out += event;
+        }
+    }
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,116 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// USDT probes for perf/bpftrace when systemtap's header is around, they
+// are a single nop each until a tracer attaches:
+//   perf probe -x bin/server sdt_tws:parse_done
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, a, b) DTRACE_PROBE2(tws, name, a, b)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name, a, b) do {} while(0)
+#endif
+
+// Timeline of one request, in ticks of Tracer::now()
+struct RequestTrace {
+    enum SPAN {
+        QUEUE,      // waiting in the ThreadPool
+        READ,
+        PARSE,
+        LOOKUP,     // HttpResponse::makeResponse, file lookup included
+        WRITEV,     // one per writev call
+        SPAN_NUM,
+    };
+
+    struct Span {
+        uint64_t start;
+        uint64_t end;
+        uint32_t type;
+        uint32_t arg;   // bytes for READ/WRITEV
+    };
+
+    static const int MAX_SPANS = 24;
+
+    int fd;
+    int code;
+    uint32_t spanCnt;
+    uint32_t dropped;   // spans past MAX_SPANS
+    char path[64];
+    Span spans[MAX_SPANS];
+
+    void reset(int fd);
+    void setPath(const std::string &path); // escaped for the JSON export
+    void add(SPAN type, uint64_t start, uint64_t end, uint32_t arg = 0) {
+        if(spanCnt < MAX_SPANS) {
+            spans[spanCnt++] = {start, end, static_cast<uint32_t>(type), arg};
+        } else {
+            dropped++;
+        }
+    }
+};
+
+// Samples one request in every N and keeps the last ones in a ring
+// buffer, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+// Timestamps come from the TSC, a few ns each, so a sampled request pays
+// little more than an unsampled one.
+class Tracer {
+public:
+    static Tracer *instance();
+    // sampleEvery 0 disables tracing
+    void init(int sampleEvery, size_t ringSize = 4096);
+    bool isEnabled() const {
+        return sampleEvery_ > 0;
+    }
+
+    // per-thread counter, no shared state
+    bool sample() {
+        static thread_local uint32_t count = 0;
+        return sampleEvery_ > 0 && ++count % sampleEvery_ == 0;
+    }
+    void submit(const RequestTrace &trace);
+
+    std::string exportChrome();
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t v;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+        return v;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+private:
+    Tracer() : sampleEvery_(0), next_(0), count_(0), baseTick_(0) {}
+    ~Tracer() = default;
+
+    static const char *const SPAN_NAME[RequestTrace::SPAN_NUM];
+
+    std::atomic<uint32_t> sampleEvery_;
+    std::mutex mtx_;
+    std::vector<RequestTrace> ring_;
+    size_t next_;
+    uint64_t count_;
+    // tick/time pair taken by init(), the rate is measured on export
+    uint64_t baseTick_;
+    std::chrono::steady_clock::time_point baseTime_;
+};
+
+#endif
@@ -26,6 +26,16 @@ public:
         return true;
     }
 
+    // a copy of the next item, it may be gone by the dequeue
+    bool front(T &item) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(que_.empty()) {
+            return false;
+        }
+        item = que_.front();
+        return true;
+    }
+
     bool empty() {
         std::lock_guard<std::mutex> lock(mtx_);
         return que_.empty();
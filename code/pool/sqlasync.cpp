@@ -0,0 +1,409 @@
+#include "sqlasync.h"
+
+#include <sys/socket.h>
+
+SqlAsync *SqlAsync::instance() {
+    static SqlAsync async;
+    return &async;
+}
+
+void SqlAsync::init(Poller *epoller, int timeoutMS) {
+    assert(epoller && timeoutMS > 0);
+    epoller_ = epoller;
+    timeoutMS_ = timeoutMS;
+    sqlFd_.reset(new std::atomic<bool>[MAX_FD]());
+}
+
+bool SqlAsync::isEnabled() const {
+    return SQL_ASYNC && epoller_ != nullptr;
+}
+
+bool SqlAsync::verify(const std::string &name, const std::string &pwd, bool isLogin,
+                      int owner, const VerifyCallBack &cbFun) {
+    if(!isEnabled()) {
+        return false;
+    }
+    if(name == "" || pwd == "") {
+        cbFun(UserStore::FAILED);
+        return true;
+    }
+    LOG_INFO("Async verify name:%s", name.c_str());
+    std::unique_ptr<Task> task(new Task);
+    task->conn = nullptr;
+    task->fd = -1;
+    task->owner = owner;
+    task->stage = SELECT;
+    task->isLogin = isLogin;
+    task->flag = !isLogin;
+    task->stepping = task->timedOut = task->aborted = task->cancelled = false;
+    task->deadline = Clock::now() + std::chrono::milliseconds(timeoutMS_);
+    task->wakeAt = Clock::time_point::max();
+    task->name = name;
+    task->pwd = pwd;
+    task->cbFun = cbFun;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        // never wait for a free connection on this path
+        task->conn = SqlConnPool::instance()->getConn(0);
+        if(task->conn) {
+            running_++;
+            active_++;
+        } else if(running_ > 0 && pending_.size() < MAX_PENDING) {
+            // all connections are busy with queries, the first one done
+            // starts this
+            pending_.push_back(std::move(task));
+            active_++;
+            return true;
+        }
+    }
+    if(!task->conn) {
+        // none in use either, the pool is down
+        cbFun(UserStore::UNAVAILABLE);
+        return true;
+    }
+    run_(std::move(task));
+    return true;
+}
+
+void SqlAsync::cancel(int owner) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for(auto it = pending_.begin(); it != pending_.end();) {
+        if((*it)->owner == owner) {
+            it = pending_.erase(it);
+            active_--;
+        } else {
+            ++it;
+        }
+    }
+    for(auto &entry : tasks_) {
+        Task &task = *entry.second;
+        if(task.owner == owner && !task.cancelled) {
+            LOG_DEBUG("Async verify %s cancelled", task.name.c_str());
+            task.cancelled = true;
+            abort_(task);
+        }
+    }
+}
+
+int SqlAsync::tick(std::vector<int> &wake) {
+    wake.clear();
+    if(active_.load(std::memory_order_relaxed) == 0) {
+        // a verify started meanwhile on a worker has its deadline later
+        return timeoutMS_;
+    }
+    std::vector<std::unique_ptr<Task>> expired, start;
+    Clock::time_point now = Clock::now();
+    Clock::time_point next = Clock::time_point::max();
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for(auto &entry : tasks_) {
+            Task &task = *entry.second;
+            if(!task.aborted && task.deadline <= now) {
+                LOG_WARN("Async verify %s: no answer in %dms", task.name.c_str(), timeoutMS_);
+                abort_(task);
+            } else if(!task.aborted) {
+                next = std::min(next, task.deadline);
+            }
+            if(task.stepping || task.timedOut) {
+                // the step sets the next wait
+                continue;
+            }
+            if(task.wakeAt <= now) {
+                task.timedOut = true;
+                wake.push_back(task.fd);
+            } else {
+                next = std::min(next, task.wakeAt);
+            }
+        }
+        // a connection the pool got back from a reconnect, the others are
+        // handed on by finish_
+        while(!pending_.empty()) {
+            std::unique_ptr<Task> &task = pending_.front();
+            if(task->deadline <= now) {
+                expired.push_back(std::move(task));
+            } else if((task->conn = SqlConnPool::instance()->getConn(0))) {
+                running_++;
+                start.push_back(std::move(task));
+            } else {
+                // in arrival order, the front's deadline is the next one
+                next = std::min(next, task->deadline);
+                break;
+            }
+            pending_.pop_front();
+        }
+        active_ -= expired.size();
+    }
+    for(std::unique_ptr<Task> &task : expired) {
+        LOG_WARN("Async verify %s: no connection in %dms", task->name.c_str(), timeoutMS_);
+        task->cbFun(UserStore::UNAVAILABLE);
+    }
+    for(std::unique_ptr<Task> &task : start) {
+        run_(std::move(task));
+    }
+    // rounded up, waking early only spins the loop; tasks parked by the
+    // workers meanwhile have their deadlines after timeoutMS_
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(next - Clock::now()).count();
+    left = std::min<decltype(left)>(left, timeoutMS_ * 1000LL);
+    return left <= 0 ? 0 : static_cast<int>((left + 999) / 1000);
+}
+
+// starts task and, while a query completes without waiting, the pending
+// task its connection is handed on to
+void SqlAsync::run_(std::unique_ptr<Task> task) {
+    while(task) {
+        int status = step_(*task, 0);
+        task = status ? park_(std::move(task), status) : finish_(*task);
+    }
+}
+
+// the next task to run when parking failed, else nullptr
+std::unique_ptr<SqlAsync::Task> SqlAsync::park_(std::unique_ptr<Task> task, int status) {
+#if SQL_ASYNC
+    task->fd = mysql_get_socket(task->conn->sql);
+#endif
+    int fd = task->fd;
+    if(fd < 0 || fd >= MAX_FD) {
+        LOG_ERROR("SqlAsync fd[%d] out of range!", fd);
+        // left in the middle of the query, reconnected by the pool
+        task->conn->broken = true;
+        task->flag = false;
+        return finish_(*task);
+    }
+    {
+        // the event may fire on another thread as soon as fd is added
+        std::lock_guard<std::mutex> lock(mtx_);
+        setWait_(*task, status);
+        tasks_[fd] = std::move(task);
+        sqlFd_[fd].store(true, std::memory_order_release);
+    }
+    if(!epoller_->addFd(fd, EPOLLONESHOT | toEvents_(status))) {
+        LOG_ERROR("SqlAsync add fd[%d] error!", fd);
+        std::unique_ptr<Task> failed = remove_(fd);
+        failed->conn->broken = true;
+        failed->flag = false;
+        return finish_(*failed);
+    }
+    return nullptr;
+}
+
+void SqlAsync::setWait_(Task &task, int status) {
+    task.stepping = false;
+    task.timedOut = false;
+    task.wakeAt = Clock::time_point::max();
+#if SQL_ASYNC
+    if(status & MYSQL_WAIT_TIMEOUT) {
+        task.wakeAt = Clock::now() + std::chrono::milliseconds(mysql_get_timeout_value_ms(task.conn->sql));
+    }
+#endif
+}
+
+void SqlAsync::abort_(Task &task) {
+    if(!task.aborted) {
+        task.aborted = true;
+        // the socket turns readable, whoever steps the task next sees the
+        // connection lost; the fd stays open until the pool closes it
+        shutdown(task.fd, SHUT_RDWR);
+    }
+}
+
+std::unique_ptr<SqlAsync::Task> SqlAsync::remove_(int fd) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::unique_ptr<Task> task = std::move(tasks_[fd]);
+    tasks_.erase(fd);
+    sqlFd_[fd].store(false, std::memory_order_release);
+    return task;
+}
+
+void SqlAsync::onEvent(int fd, uint32_t events) {
+    Task *task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = tasks_.find(fd);
+        if(it == tasks_.end()) {
+            return;
+        }
+        task = it->second.get();
+        // EPOLLONESHOT keeps two socket events apart, not an event and a
+        // wake from tick(); the one stepping re-arms the fd anyway
+        if(task->stepping || (!events && !task->timedOut)) {
+            return;
+        }
+        task->stepping = true;
+    }
+    int status = step_(*task, toStatus_(events));
+    if(status) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            setWait_(*task, status);
+        }
+        epoller_->modFd(fd, EPOLLONESHOT | toEvents_(status));
+        return;
+    }
+    epoller_->delFd(fd);
+    std::unique_ptr<Task> done = remove_(fd);
+    run_(finish_(*done));
+}
+
+// drive the SELECT [-> INSERT] state machine until it has to wait.
+// status: 0 to start the current stage, the MYSQL_WAIT_* mask to continue it.
+// return: the MYSQL_WAIT_* mask to wait for, 0 when the task is done
+int SqlAsync::step_(Task &task, int status) {
+#if SQL_ASYNC
+    int err = 0;
+    SqlConn *conn = task.conn;
+    std::string password;
+    switch(task.stage) {
+    case SELECT:
+        if(!status && !conn->bindQuery(task.name)) {
+            task.flag = false;
+            break;
+        }
+        status = status ? mysql_stmt_execute_cont(&err, conn->queryStmt, status)
+                        : mysql_stmt_execute_start(&err, conn->queryStmt);
+        if(status) {
+            return status;
+        }
+        if(err) {
+            LOG_WARN("Async select error: %s", mysql_stmt_error(conn->queryStmt));
+            conn->checkError(mysql_stmt_errno(conn->queryStmt));
+            task.flag = false;
+            break;
+        }
+        task.stage = STORE;
+        // fall through, the result is read right away
+    case STORE:
+        status = status ? mysql_stmt_store_result_cont(&err, conn->queryStmt, status)
+                        : mysql_stmt_store_result_start(&err, conn->queryStmt);
+        if(status) {
+            return status;
+        }
+        if(err) {
+            LOG_WARN("Async store error: %s", mysql_stmt_error(conn->queryStmt));
+            conn->checkError(mysql_stmt_errno(conn->queryStmt));
+            task.flag = false;
+            break;
+        }
+        // rows are buffered now, fetching never blocks
+        if(conn->fetchPassword(password)) {
+            UserCache::instance()->put(task.name, password);
+            if(task.isLogin) {
+                task.flag = (task.pwd == password);
+                if(!task.flag) {
+                    LOG_INFO("%s: pwd error", task.name.c_str());
+                }
+            } else {
+                task.flag = false;
+                LOG_INFO("user %s used", task.name.c_str());
+            }
+        } else {
+            UserCache::instance()->putNegative(task.name);
+        }
+        mysql_stmt_free_result(conn->queryStmt);
+        if(task.isLogin || !task.flag) {
+            break;
+        }
+        LOG_DEBUG("%s: register", task.name.c_str());
+        if(!conn->bindInsert(task.name, task.pwd)) {
+            task.flag = false;
+            break;
+        }
+        task.stage = INSERT;
+        // fall through
+    case INSERT:
+        status = status ? mysql_stmt_execute_cont(&err, conn->insertStmt, status)
+                        : mysql_stmt_execute_start(&err, conn->insertStmt);
+        if(status) {
+            return status;
+        }
+        if(err) {
+            LOG_DEBUG("Insert error: %s", mysql_stmt_error(conn->insertStmt));
+            conn->checkError(mysql_stmt_errno(conn->insertStmt));
+            task.flag = false;
+        }
+        // drop the negative entry of the new user
+        UserCache::instance()->invalidate(task.name);
+        break;
+    default:
+        break;
+    }
+#else
+    task.flag = false;
+#endif
+    task.stage = DONE;
+    return 0;
+}
+
+std::unique_ptr<SqlAsync::Task> SqlAsync::finish_(Task &task) {
+    std::unique_ptr<Task> next;
+    UserStore::RESULT res = task.flag ? UserStore::OK : UserStore::FAILED;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(task.aborted) {
+            // the socket is shut down, whatever the step saw
+            task.conn->broken = true;
+        }
+        if(!task.conn->isAlive()) {
+            // lost or timed out, the credentials were never checked
+            res = UserStore::UNAVAILABLE;
+        }
+        if(task.conn->isAlive() && !pending_.empty()) {
+            // the connection goes on to the longest waiting verify
+            next = std::move(pending_.front());
+            pending_.pop_front();
+            next->conn = task.conn;
+        } else {
+            // freed under the lock: verify() sees it free or running_ > 0
+            running_--;
+            SqlConnPool::instance()->freeConn(task.conn);
+        }
+        active_--;
+    }
+    task.conn = nullptr;
+    if(task.cancelled) {
+        return next;
+    }
+    LOG_DEBUG("Async verify %s: %d", task.name.c_str(), res);
+    task.cbFun(res);
+    return next;
+}
+
+uint32_t SqlAsync::toEvents_(int status) {
+    uint32_t events = 0;
+#if SQL_ASYNC
+    if(status & MYSQL_WAIT_READ) {
+        events |= EPOLLIN;
+    }
+    if(status & MYSQL_WAIT_WRITE) {
+        events |= EPOLLOUT;
+    }
+    if(status & MYSQL_WAIT_EXCEPT) {
+        events |= EPOLLPRI;
+    }
+    if(!events) {
+        // MYSQL_WAIT_TIMEOUT alone, wake up on the socket anyway
+        events = EPOLLIN;
+    }
+#endif
+    return events;
+}
+
+int SqlAsync::toStatus_(uint32_t events) {
+    int status = 0;
+#if SQL_ASYNC
+    if(!events) {
+        // woken by tick()
+        return MYSQL_WAIT_TIMEOUT;
+    }
+    // let the library see hangups and errors through the read path
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        status |= MYSQL_WAIT_READ;
+    }
+    if(events & EPOLLOUT) {
+        status |= MYSQL_WAIT_WRITE;
+    }
+    if(events & EPOLLPRI) {
+        status |= MYSQL_WAIT_EXCEPT;
+    }
+#endif
+    return status;
+}
@@ -0,0 +1,127 @@
+#ifndef SQLASYNC_H
+#define SQLASYNC_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+#include "../log/log.h"
+#include "../server/poller.h"
+#include "../cache/usercache.h"
+#include "../user/userstore.h"
+#include "sqlconnpool.h"
+
+// Non-blocking user verification on top of the MariaDB *_start/*_cont API
+// and the prepared statements cached on each SqlConn.
+// The socket of a pooled connection is registered in the Poller
+// while a query waits, so a slow database parks the request instead of
+// blocking a ThreadPool worker.
+class SqlAsync {
+public:
+    typedef std::function<void(UserStore::RESULT)> VerifyCallBack;
+
+    static SqlAsync *instance();
+    // timeoutMS: a verify not answered by then gets UNAVAILABLE
+    void init(Poller *epoller, int timeoutMS = 3000);
+    bool isEnabled() const;
+
+    // false: async path unavailable, the caller has to verify synchronously.
+    // true: cbFun is called once with the result, either before verify()
+    //       returns or later from the thread that calls onEvent() or tick();
+    //       while every pooled connection runs a query the verify waits
+    //       for one, UNAVAILABLE when the pool is down, too many wait or
+    //       the database did not answer within timeoutMS.
+    // owner: the client fd, for cancel()
+    bool verify(const std::string &name, const std::string &pwd, bool isLogin,
+                int owner, const VerifyCallBack &cbFun);
+    // the owner closed: its verify is dropped without a callback and a
+    // query in flight is aborted, the connection is rebuilt by the pool
+    void cancel(int owner);
+
+    // without a lock, the loop asks it for every event
+    bool isSqlFd(int fd) const {
+        return fd >= 0 && fd < MAX_FD && sqlFd_ && sqlFd_[fd].load(std::memory_order_acquire);
+    }
+    // events 0: the library's timeout passed, from tick()
+    void onEvent(int fd, uint32_t events);
+    // called by the loop on every wakeup: aborts the queries past their
+    // deadline, starts or expires the waiting verifies. wake gets the
+    // fds whose library timeout passed, to be run as onEvent(fd, 0).
+    // return: ms to the next deadline, at most timeoutMS
+    int tick(std::vector<int> &wake);
+
+private:
+    enum STAGE {
+        SELECT,
+        STORE,
+        INSERT,
+        DONE,
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task {
+        SqlConn *conn;
+        int fd;
+        int owner;
+        STAGE stage;
+        bool isLogin;
+        bool flag;
+        bool stepping;      // onEvent runs it, tick must not wake it
+        bool timedOut;      // tick passed fd to wake
+        bool aborted;       // past the deadline or cancelled, socket shut down
+        bool cancelled;     // no callback
+        Clock::time_point deadline;
+        Clock::time_point wakeAt;   // MYSQL_WAIT_TIMEOUT, max(): none
+        std::string name;
+        std::string pwd;
+        VerifyCallBack cbFun;
+    };
+
+    static const int MAX_FD = 65536;
+    // verifies waiting for a connection, beyond it answered UNAVAILABLE
+    static const size_t MAX_PENDING = 1024;
+
+    SqlAsync() : epoller_(nullptr), timeoutMS_(3000), running_(0), active_(0) {}
+    ~SqlAsync() = default;
+
+    void run_(std::unique_ptr<Task> task);
+    std::unique_ptr<Task> park_(std::unique_ptr<Task> task, int status);
+    // under mtx_, the task waits for status now
+    void setWait_(Task &task, int status);
+    // under mtx_, shuts the socket down: the next step fails
+    static void abort_(Task &task);
+    int step_(Task &task, int status);
+    // out of tasks_, after delFd
+    std::unique_ptr<Task> remove_(int fd);
+    // frees or hands on the connection, then calls back;
+    // return: the pending task that got the connection
+    std::unique_ptr<Task> finish_(Task &task);
+
+    static uint32_t toEvents_(int status);
+    static int toStatus_(uint32_t events);
+
+    Poller *epoller_;
+    int timeoutMS_;
+    std::mutex mtx_;
+    // socket fd of the connection: parked query
+    std::unordered_map<int, std::unique_ptr<Task>> tasks_;
+    // by socket fd, set while the fd is in tasks_
+    std::unique_ptr<std::atomic<bool>[]> sqlFd_;
+    // tasks holding a connection
+    int running_;
+    // waiting for a connection, in arrival order
+    std::deque<std::unique_ptr<Task>> pending_;
+    // running and pending, tick() returns at once without any
+    std::atomic<int> active_;
+};
+
+#endif
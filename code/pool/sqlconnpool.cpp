@@ -1,5 +1,138 @@
 #include "sqlconnpool.h"
 
+SqlConn::SqlConn() : sql(nullptr), queryStmt(nullptr), insertStmt(nullptr), broken(false) {
+    lastUsed = lastRetry = std::chrono::steady_clock::now();
+}
+
+SqlConn::~SqlConn() {
+    close();
+}
+
+bool SqlConn::connect(const char *host, int port,
+                      const char *user, const char *pwd, const char *dbName,
+                      unsigned int ioTimeoutS) {
+    close();
+    sql = mysql_init(nullptr);
+    if(!sql) {
+        LOG_ERROR("MySql Init Error...");
+        return false;
+    }
+    unsigned int timeout = 3;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if(ioTimeoutS > 0) {
+        // a hung server fails the query instead of holding the connection,
+        // the non-blocking calls report it as MYSQL_WAIT_TIMEOUT
+        mysql_options(sql, MYSQL_OPT_READ_TIMEOUT, &ioTimeoutS);
+        mysql_options(sql, MYSQL_OPT_WRITE_TIMEOUT, &ioTimeoutS);
+    }
+#if SQL_ASYNC
+    // allow the *_start/*_cont calls, blocking calls still work
+    mysql_options(sql, MYSQL_OPT_NONBLOCK, 0);
+#endif
+    if(!mysql_real_connect(sql, host, user, pwd, dbName, port, nullptr, 0)) {
+        LOG_ERROR("Mysql Connect Error: %s", mysql_error(sql));
+        close();
+        return false;
+    }
+    // parse once per connection instead of once per login
+    queryStmt = prepare_("SELECT username, password FROM user WHERE username = ? LIMIT 1");
+    insertStmt = prepare_("INSERT INTO user(username, password) VALUES(?, ?)");
+    if(!queryStmt || !insertStmt) {
+        close();
+        return false;
+    }
+    broken = false;
+    lastUsed = std::chrono::steady_clock::now();
+    return true;
+}
+
+void SqlConn::close() {
+    if(queryStmt) {
+        mysql_stmt_close(queryStmt);
+        queryStmt = nullptr;
+    }
+    if(insertStmt) {
+        mysql_stmt_close(insertStmt);
+        insertStmt = nullptr;
+    }
+    if(sql) {
+        mysql_close(sql);
+        sql = nullptr;
+    }
+}
+
+void SqlConn::checkError(unsigned int err) {
+    if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+        broken = true;
+    }
+}
+
+MYSQL_STMT *SqlConn::prepare_(const char *order) {
+    MYSQL_STMT *stmt = mysql_stmt_init(sql);
+    if(!stmt) {
+        LOG_ERROR("Mysql Stmt Init Error...");
+        return nullptr;
+    }
+    if(mysql_stmt_prepare(stmt, order, strlen(order))) {
+        LOG_ERROR("Mysql Prepare Error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+bool SqlConn::bindQuery(const std::string &name) {
+    assert(queryStmt);
+    paramName_ = name;
+    paramLen_[0] = paramName_.size();
+    memset(params_, 0, sizeof(params_));
+    params_[0].buffer_type = MYSQL_TYPE_STRING;
+    params_[0].buffer = const_cast<char *>(paramName_.data());
+    params_[0].buffer_length = paramName_.size();
+    params_[0].length = &paramLen_[0];
+
+    memset(results_, 0, sizeof(results_));
+    results_[0].buffer_type = MYSQL_TYPE_STRING;
+    results_[0].buffer = resName_;
+    results_[0].buffer_length = FIELD_LEN;
+    results_[0].length = &resLen_[0];
+    results_[1].buffer_type = MYSQL_TYPE_STRING;
+    results_[1].buffer = resPwd_;
+    results_[1].buffer_length = FIELD_LEN;
+    results_[1].length = &resLen_[1];
+    return !mysql_stmt_bind_param(queryStmt, params_)
+        && !mysql_stmt_bind_result(queryStmt, results_);
+}
+
+bool SqlConn::bindInsert(const std::string &name, const std::string &pwd) {
+    assert(insertStmt);
+    paramName_ = name;
+    paramPwd_ = pwd;
+    paramLen_[0] = paramName_.size();
+    paramLen_[1] = paramPwd_.size();
+    memset(params_, 0, sizeof(params_));
+    params_[0].buffer_type = MYSQL_TYPE_STRING;
+    params_[0].buffer = const_cast<char *>(paramName_.data());
+    params_[0].buffer_length = paramName_.size();
+    params_[0].length = &paramLen_[0];
+    params_[1].buffer_type = MYSQL_TYPE_STRING;
+    params_[1].buffer = const_cast<char *>(paramPwd_.data());
+    params_[1].buffer_length = paramPwd_.size();
+    params_[1].length = &paramLen_[1];
+    return !mysql_stmt_bind_param(insertStmt, params_);
+}
+
+bool SqlConn::fetchPassword(std::string &pwd) {
+    int ret = mysql_stmt_fetch(queryStmt);
+    if(ret != 0) {
+        // MYSQL_NO_DATA, or a column longer than FIELD_LEN
+        return false;
+    }
+    LOG_DEBUG("MYSQL ROW: %.*s %.*s", (int)resLen_[0], resName_, (int)resLen_[1], resPwd_);
+    pwd.assign(resPwd_, resLen_[1]);
+    return true;
+}
+
 SqlConnPool *SqlConnPool::instance() {
     static SqlConnPool pool;
     return &pool;
@@ -7,44 +140,88 @@ SqlConnPool *SqlConnPool::instance() {
 
 void SqlConnPool::init(const char *host, int port,
                 const char *user, const char *pwd,
-                const char *dbName, int connSize) {
+                const char *dbName, int connSize,
+                int waitTimeoutMS, int queryTimeoutMS) {
     assert(connSize > 0);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    waitTimeoutMS_ = waitTimeoutMS;
+    // the option takes seconds, rounded up
+    ioTimeoutS_ = queryTimeoutMS > 0 ? (queryTimeoutMS + 999) / 1000 : 0;
+    closing_ = false;
+    int alive = 0;
     for(int i = 0; i < connSize; i++) {
-        MYSQL *conn = nullptr;
-        conn = mysql_init(conn);
-        if(!conn) {
-            LOG_ERROR("MySql Init Error...");
-            assert(conn);
+        SqlConn *conn = new SqlConn;
+        // a failed slot waits for the maintainer instead of being handed out
+        if(conn->connect(host, port, user, pwd, dbName, ioTimeoutS_)) {
+            alive++;
+            connQue_.enqueue(conn);
+        } else {
+            broken_.push_back(conn);
         }
-        conn = mysql_real_connect(conn, host, user, pwd, dbName, port, nullptr, 0);
-        if(!conn) {
-            LOG_ERROR("Mysql Connect Error...");
-        }
-        connQue_.enqueue(conn);
+    }
+    if(alive < connSize) {
+        LOG_WARN("SqlConnPool: %d of %d connections alive", alive, connSize);
     }
     MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    sem_init(&semId_, 0, alive);
+    maintainer_ = std::thread(&SqlConnPool::maintain_, this);
 }
 
-MYSQL *SqlConnPool::getConn() {
-    MYSQL *conn = nullptr;
-    bool dequeued = false;
-    if(connQue_.empty()) {
-        LOG_WARN("SqlConnPool busy!");
-        return nullptr;
+SqlConn *SqlConnPool::getConn(int timeoutMS) {
+    if(timeoutMS < 0) {
+        timeoutMS = waitTimeoutMS_;
     }
-    sem_wait(&semId_); // -1
-    dequeued = connQue_.dequeue(conn);
-    if(!dequeued) {
+    auto start = std::chrono::steady_clock::now();
+    int ret = sem_trywait(&semId_); // -1
+    if(ret != 0 && timeoutMS > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeoutMS / 1000;
+        deadline.tv_nsec += (timeoutMS % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while((ret = sem_timedwait(&semId_, &deadline)) != 0 && errno == EINTR) {}
+        recordWait_(start);
+    }
+    if(ret != 0) {
+        timeoutCount_++;
         LOG_WARN("SqlConnPool busy!");
         return nullptr;
     }
-    return conn;
+    SqlConn *conn = nullptr;
+    for(;;) {
+        if(!connQue_.dequeue(conn)) {
+            sem_post(&semId_);
+            LOG_WARN("SqlConnPool busy!");
+            return nullptr;
+        }
+        if(conn->isAlive()) {
+            return conn;
+        }
+        // broken while queued, the next one may be fine
+        repair_(conn);
+        if(sem_trywait(&semId_) != 0) {
+            LOG_WARN("SqlConnPool: no live connection!");
+            return nullptr;
+        }
+    }
 }
 
-void SqlConnPool::freeConn(MYSQL *conn) {
+void SqlConnPool::freeConn(SqlConn *conn) {
     assert(conn);
-    connQue_.dequeue(conn);
+    if(!conn->isAlive()) {
+        // a lost server, seen by the query
+        repair_(conn);
+        return;
+    }
+    conn->lastUsed = std::chrono::steady_clock::now();
+    connQue_.enqueue(conn);
     sem_post(&semId_); // +1
 }
 
@@ -52,11 +229,117 @@ int SqlConnPool::getFreeConnCount() {
     return connQue_.size();
 }
 
+void SqlConnPool::repair_(SqlConn *conn) {
+    {
+        std::lock_guard<std::mutex> lock(repairMtx_);
+        broken_.push_back(conn);
+    }
+    repairCond_.notify_one();
+}
+
+// reconnect the broken connections, at most once per RETRY_MS each so a
+// database that is down is not hammered, and ping the idle ones
+void SqlConnPool::maintain_() {
+    mysql_thread_init();
+    std::vector<SqlConn *> broken;
+    std::unique_lock<std::mutex> lock(repairMtx_);
+    while(!closing_) {
+        if(broken_.empty()) {
+            repairCond_.wait_for(lock, std::chrono::milliseconds(RETRY_MS));
+        }
+        if(closing_) {
+            break;
+        }
+        broken.swap(broken_);
+        lock.unlock();
+
+        auto now = std::chrono::steady_clock::now();
+        std::vector<SqlConn *> failed;
+        for(SqlConn *conn : broken) {
+            if(now - conn->lastRetry < std::chrono::milliseconds(RETRY_MS)) {
+                failed.push_back(conn);
+                continue;
+            }
+            conn->lastRetry = now;
+            reconnectCount_++;
+            LOG_INFO("Mysql reconnect...");
+            if(conn->connect(host_.c_str(), port_, user_.c_str(), pwd_.c_str(), dbName_.c_str(), ioTimeoutS_)) {
+                freeConn(conn);
+            } else {
+                failed.push_back(conn);
+            }
+        }
+        broken.clear();
+        pingIdle_(failed);
+
+        lock.lock();
+        broken_.insert(broken_.end(), failed.begin(), failed.end());
+        if(!failed.empty() && !closing_) {
+            // the failed ones are retried after RETRY_MS, not right away
+            repairCond_.wait_for(lock, std::chrono::milliseconds(RETRY_MS));
+        }
+    }
+    lock.unlock();
+    mysql_thread_end();
+}
+
+// the queue is in freeConn order, the idle ones are at its front
+void SqlConnPool::pingIdle_(std::vector<SqlConn *> &broken) {
+    auto isIdle = [](SqlConn *conn) {
+        return std::chrono::steady_clock::now() - conn->lastUsed >= std::chrono::milliseconds(PING_IDLE_MS);
+    };
+    size_t count = connQue_.size();
+    for(size_t i = 0; i < count; i++) {
+        // a look first, a connection in use is not taken from getConn
+        SqlConn *conn = nullptr;
+        if(!connQue_.front(conn) || !isIdle(conn) || sem_trywait(&semId_) != 0) {
+            return;
+        }
+        if(!connQue_.dequeue(conn)) {
+            sem_post(&semId_);
+            return;
+        }
+        if(!isIdle(conn)) {
+            // taken and freed meanwhile
+            connQue_.enqueue(conn);
+            sem_post(&semId_);
+            return;
+        }
+        if(mysql_ping(conn->sql) != 0) {
+            LOG_WARN("Mysql ping error: %s", mysql_error(conn->sql));
+            conn->broken = true;
+            broken.push_back(conn);
+            continue;
+        }
+        freeConn(conn);
+    }
+}
+
+void SqlConnPool::recordWait_(std::chrono::steady_clock::time_point start) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+    waitCount_++;
+    waitTimeUs_ += us;
+    uint64_t maxUs = maxWaitUs_;
+    while(us > maxUs && !maxWaitUs_.compare_exchange_weak(maxUs, us)) {}
+}
 
 void SqlConnPool::closePool() {
-    MYSQL *conn = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(repairMtx_);
+        closing_ = true;
+    }
+    repairCond_.notify_one();
+    if(maintainer_.joinable()) {
+        maintainer_.join();
+    }
+    SqlConn *conn = nullptr;
     while(connQue_.dequeue(conn)) {
-        mysql_close(conn);
+        delete conn;
     }
+    for(SqlConn *broken : broken_) {
+        delete broken;
+    }
+    broken_.clear();
     mysql_library_end();
-}
\ No newline at end of file
+}
@@ -2,36 +2,131 @@
 #define SQLCONNPOOL_H
 
 #include<mysql/mysql.h>
+#include<mysql/errmsg.h>
 #include<string>
 #include<mutex>
 #include<thread>
+#include<atomic>
+#include<chrono>
+#include<vector>
+#include<condition_variable>
 #include<semaphore.h>
 #include "../log/log.h"
 #include "safequeue.h"
 
+// MariaDB Connector/C provides the non-blocking *_start/*_cont API,
+// the MYSQL_WAIT_* masks are only defined by it
+#ifdef MYSQL_WAIT_READ
+#define SQL_ASYNC 1
+#else
+#define SQL_ASYNC 0
+#endif
+
+// a pooled connection with its cached prepared statements
+class SqlConn {
+public:
+    SqlConn();
+    ~SqlConn();
+
+    // ioTimeoutS: read/write timeout of the socket, 0: none
+    bool connect(const char *host, int port,
+                 const char *user, const char *pwd, const char *dbName,
+                 unsigned int ioTimeoutS = 0);
+    void close();
+    bool isAlive() const {
+        return sql && !broken;
+    }
+    // mark the connection broken if the last error was a lost server
+    void checkError(unsigned int err);
+
+    // bind the parameters (and results), the caller executes the statement
+    bool bindQuery(const std::string &name);
+    bool bindInsert(const std::string &name, const std::string &pwd);
+    // fetch the password column of the stored query result
+    bool fetchPassword(std::string &pwd);
+
+    MYSQL *sql;
+    MYSQL_STMT *queryStmt;  // SELECT username, password FROM user WHERE username = ? LIMIT 1
+    MYSQL_STMT *insertStmt; // INSERT INTO user(username, password) VALUES(?, ?)
+    bool broken;
+    std::chrono::steady_clock::time_point lastUsed;
+    std::chrono::steady_clock::time_point lastRetry;
+
+private:
+    static const size_t FIELD_LEN = 256;
+
+    MYSQL_STMT *prepare_(const char *order);
+
+    std::string paramName_;
+    std::string paramPwd_;
+    unsigned long paramLen_[2];
+    MYSQL_BIND params_[2];
+
+    char resName_[FIELD_LEN];
+    char resPwd_[FIELD_LEN];
+    unsigned long resLen_[2];
+    MYSQL_BIND results_[2];
+};
+
 class SqlConnPool {
 public:
     static SqlConnPool *instance();
-    MYSQL *getConn();
-    void freeConn(MYSQL* conn);
+    // timeoutMS: -1 waits the configured time, 0 never waits
+    SqlConn *getConn(int timeoutMS = -1);
+    void freeConn(SqlConn *conn);
     int getFreeConnCount();
     void init(const char *host, int port,
               const char *user, const char *pwd,
-              const char *dbName, int connSize);
+              const char *dbName, int connSize,
+              int waitTimeoutMS = 500, int queryTimeoutMS = 3000);
     void closePool();
+
+    // getConn wait metrics
+    uint64_t waitCount() const { return waitCount_; }
+    uint64_t waitTimeUs() const { return waitTimeUs_; }
+    uint64_t maxWaitUs() const { return maxWaitUs_; }
+    uint64_t timeoutCount() const { return timeoutCount_; }
+    uint64_t reconnectCount() const { return reconnectCount_; }
 private:
     SqlConnPool() = default;
     ~SqlConnPool() {closePool(); }
 
+    // never connected or broken: out of the queue until maintain_ reconnects it
+    void repair_(SqlConn *conn);
+    // the thread that pings and reconnects, getConn never does
+    void maintain_();
+    void pingIdle_(std::vector<SqlConn *> &broken);
+    void recordWait_(std::chrono::steady_clock::time_point start);
+
+    // ping connections idle for longer, reconnect at most once per RETRY
+    static const int PING_IDLE_MS = 30000;
+    static const int RETRY_MS = 1000;
+
     int MAX_CONN_;
+    int waitTimeoutMS_;
+    unsigned int ioTimeoutS_;
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
     std::mutex mtx_;
-    SafeQueue<MYSQL *> connQue_;
-    sem_t semId_;
+    SafeQueue<SqlConn *> connQue_;
+    sem_t semId_;   // connections in connQue_
+
+    std::thread maintainer_;
+    std::mutex repairMtx_;
+    std::condition_variable repairCond_;
+    std::vector<SqlConn *> broken_;
+    bool closing_ = false;
+
+    std::atomic<uint64_t> waitCount_{0};
+    std::atomic<uint64_t> waitTimeUs_{0};
+    std::atomic<uint64_t> maxWaitUs_{0};
+    std::atomic<uint64_t> timeoutCount_{0};
+    std::atomic<uint64_t> reconnectCount_{0};
 };
 
 class SqlConnRAII {
 public:
-    SqlConnRAII(MYSQL **sql, SqlConnPool *connpool) {
+    SqlConnRAII(SqlConn **sql, SqlConnPool *connpool) {
         connpool_ = connpool;
         assert(connpool_);
         *sql = connpool_->getConn();
@@ -43,8 +138,8 @@ public:
         }
     }
 private:
-    MYSQL *sql_;
+    SqlConn *sql_;
     SqlConnPool* connpool_;
 };
 
-#endif
\ No newline at end of file
+#endif
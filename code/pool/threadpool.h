@@ -12,9 +12,11 @@
 
 class ThreadPool {
 public:
-    explicit ThreadPool(int n_threads) {
+    // onStart runs first in each thread with its index, e.g. to place it
+    explicit ThreadPool(int n_threads, std::function<void(int)> onStart = nullptr) {
         m_threads_.resize(n_threads);
         m_shutdown_ = false;
+        m_on_start_ = onStart;
         for(int i = 0; i < (int)m_threads_.size(); i++) {
             m_threads_.at(i) = std::thread(ThreadWorker(this, i));
         }
@@ -37,6 +39,11 @@ public:
         return sptr->get_future();
     }
 
+    // tasks waiting for a worker
+    size_t queueSize() {
+        return que_.size();
+    }
+
     ~ThreadPool() {
         {
             std::lock_guard<std::mutex> lock(m_conditional_mtx_);
@@ -58,6 +65,9 @@ private:
         void operator()() {
             std::function<void()> func;
             bool dequeued;
+            if(m_pool_->m_on_start_) {
+                m_pool_->m_on_start_(m_id_);
+            }
             while(true) {
                 {
                     std::unique_lock<std::mutex> lock(m_pool_->m_conditional_mtx_);
@@ -80,6 +90,7 @@ private:
     };
 private:
     bool m_shutdown_;
+    std::function<void(int)> m_on_start_;
     std::condition_variable m_conditional_lock_;
     SafeQueue<std::function<void()>> que_;
     std::vector<std::thread> m_threads_;
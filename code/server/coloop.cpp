@@ -0,0 +1,124 @@
+#include "coloop.h"
+#include "../http/httpconn.h"
+#include "../pool/sqlasync.h"
+
+#include <sys/epoll.h>
+
+CoLoop::ReadOp::ReadOp(CoLoop *loop, HttpConn *conn)
+    : Op(loop, conn->getFd(), EPOLLIN), conn_(conn) {
+}
+
+// edge triggered: false only once the socket said EAGAIN
+bool CoLoop::ReadOp::tryRead_() {
+    size_t before = conn_->readableBytes();
+    int err = 0;
+    ssize_t len = conn_->read(&err);
+    size_t got = conn_->readableBytes() - before;
+    if(got > 0) {
+        n_ = got;
+        return true;
+    }
+    if(len < 0 && err == EAGAIN) {
+        return false;
+    }
+    n_ = len < 0 ? -1 : 0;
+    return true;
+}
+
+CoLoop::WriteOp::WriteOp(CoLoop *loop, HttpConn *conn)
+    : Op(loop, conn->getFd(), EPOLLOUT), conn_(conn) {
+}
+
+bool CoLoop::WriteOp::tryWrite_() {
+    int err = 0;
+    ssize_t len = conn_->toWriteBytes() > 0 ? conn_->write(&err) : 0;
+    if(conn_->toWriteBytes() == 0) {
+        result_ = true;
+        return true;
+    }
+    if(len < 0 && err == EAGAIN) {
+        return false;
+    }
+    result_ = false;
+    return true;
+}
+
+void CoLoop::SleepOp::await_suspend(std::coroutine_handle<> h) {
+    CoLoop *loop = loop_;
+    int fd = fd_;
+    uint64_t seq = loop->park_(this, h);
+    suspended_ = true;
+    int id = loop->idBase_ + static_cast<int>(seq % (INT32_MAX - loop->idBase_));
+    loop->timer_->add(id, ms_, [loop, fd, seq] { loop->finish_(fd, seq, 1); });
+}
+
+bool CoLoop::VerifyOp::await_suspend(std::coroutine_handle<> h) {
+    CoLoop *loop = loop_;
+    int fd = fd_;
+    uint64_t seq = loop->park_(this, h);
+    bool async = SqlAsync::instance()->verify(name_, pwd_, isLogin_, fd,
+        [loop, fd, seq](UserStore::RESULT res) { loop->finish_(fd, seq, res); });
+    if(!async) {
+        loop->waiters_.erase(fd);
+        result_ = UserStore::FAILED;
+        return false;
+    }
+    // answered before verify() returned, e.g. from the UserCache
+    if(seq_ == 0) {
+        return false;
+    }
+    suspended_ = true;
+    return true;
+}
+
+uint64_t CoLoop::park_(Op *op, std::coroutine_handle<> h) {
+    assert(waiters_.count(op->fd_) == 0);
+    op->handle_ = h;
+    op->seq_ = ++seq_;
+    waiters_[op->fd_] = op;
+    return op->seq_;
+}
+
+void CoLoop::finish_(int fd, uint64_t seq, int result) {
+    auto it = waiters_.find(fd);
+    if(it == waiters_.end() || it->second->seq_ != seq) {
+        // cancelled meanwhile
+        return;
+    }
+    Op *op = it->second;
+    waiters_.erase(it);
+    op->result_ = result;
+    op->seq_ = 0;
+    if(op->suspended_) {
+        op->handle_.resume();
+    }
+}
+
+void CoLoop::onEvents(int fd, uint32_t events) {
+    auto it = waiters_.find(fd);
+    if(it == waiters_.end() || !(it->second->want_ & events)) {
+        // an edge nobody waits for: the next operation tries first anyway
+        return;
+    }
+    Op *op = it->second;
+    if(!op->onEvents(events)) {
+        return;
+    }
+    waiters_.erase(it);
+    op->handle_.resume();
+}
+
+void CoLoop::cancel(int fd) {
+    auto it = waiters_.find(fd);
+    if(it == waiters_.end()) {
+        return;
+    }
+    Op *op = it->second;
+    waiters_.erase(it);
+    op->cancelled_ = true;
+    op->seq_ = 0;
+    // a verify answered before it suspended is not resumed here
+    if(op->want_ || op->suspended_) {
+        op->handle_.resume();
+    }
+}
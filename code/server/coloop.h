@@ -0,0 +1,174 @@
+#ifndef CO_LOOP_H
+#define CO_LOOP_H
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../timer/heaptimer.h"
+#include "../user/userstore.h"
+
+class HttpConn;
+
+// A coroutine nobody waits for: it starts at once, runs until its first
+// co_await that has to wait, and frees itself when it returns.
+struct CoTask {
+    struct promise_type {
+        CoTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Resumes coroutines from the event loop. Everything runs on the loop
+// thread, a suspended coroutine holds no thread, only its frame.
+// A coroutine waits on one operation per connection fd at a time;
+// cancel(fd) wakes it with the operation cancelled, the connection is
+// closed by then and the coroutine has to return.
+class CoLoop {
+public:
+    class Op {
+    public:
+        bool cancelled() const {
+            return cancelled_;
+        }
+    protected:
+        friend class CoLoop;
+        Op(CoLoop *loop, int fd, uint32_t want) : loop_(loop), fd_(fd), want_(want) {}
+        // an event in want_ arrived: true once the operation is done
+        virtual bool onEvents(uint32_t events) {
+            return true;
+        }
+
+        CoLoop *loop_;
+        int fd_;
+        uint32_t want_;     // epoll events resuming it, 0: woken by finish_()
+        uint64_t seq_ = 0;
+        bool suspended_ = false;
+        bool cancelled_ = false;
+        int result_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+    // reads what the socket has; > 0 bytes read, 0: peer closed,
+    // < 0: error or cancelled
+    class ReadOp : public Op {
+    public:
+        ReadOp(CoLoop *loop, HttpConn *conn);
+        bool await_ready() {
+            return tryRead_();
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            loop_->park_(this, h);
+        }
+        ssize_t await_resume() const {
+            return cancelled_ ? -1 : n_;
+        }
+    private:
+        bool onEvents(uint32_t events) override {
+            return tryRead_();
+        }
+        bool tryRead_();
+
+        HttpConn *conn_;
+        ssize_t n_ = -1;
+    };
+
+    // the whole pending response; false: not sent, or cancelled
+    class WriteOp : public Op {
+    public:
+        WriteOp(CoLoop *loop, HttpConn *conn);
+        bool await_ready() {
+            return tryWrite_();
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            loop_->park_(this, h);
+        }
+        bool await_resume() const {
+            return !cancelled_ && result_;
+        }
+    private:
+        bool onEvents(uint32_t events) override {
+            return tryWrite_();
+        }
+        bool tryWrite_();
+
+        HttpConn *conn_;
+    };
+
+    class SleepOp : public Op {
+    public:
+        SleepOp(CoLoop *loop, int fd, int ms) : Op(loop, fd, 0), ms_(ms) {}
+        bool await_ready() const {
+            return ms_ <= 0;
+        }
+        void await_suspend(std::coroutine_handle<> h);
+        // false: cancelled
+        bool await_resume() const {
+            return !cancelled_;
+        }
+    private:
+        int ms_;
+    };
+
+    // a user lookup parked on SqlAsync; FAILED: wrong password, unknown
+    // or taken name, database error, or cancelled
+    class VerifyOp : public Op {
+    public:
+        VerifyOp(CoLoop *loop, int fd, const std::string &name, const std::string &pwd, bool isLogin)
+            : Op(loop, fd, 0), name_(name), pwd_(pwd), isLogin_(isLogin) {}
+        bool await_ready() const {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> h);
+        UserStore::RESULT await_resume() const {
+            return cancelled_ ? UserStore::FAILED : static_cast<UserStore::RESULT>(result_);
+        }
+    private:
+        std::string name_;
+        std::string pwd_;
+        bool isLogin_;
+    };
+
+    // sleeps take timer ids from idBase up, below are the connections'
+    CoLoop(HeapTimer *timer, int idBase) : timer_(timer), idBase_(idBase), seq_(0) {}
+
+    ReadOp read(HttpConn *conn) {
+        return ReadOp(this, conn);
+    }
+    WriteOp write(HttpConn *conn) {
+        return WriteOp(this, conn);
+    }
+    // belongs to fd: cancelled with the connection
+    SleepOp sleep(int fd, int ms) {
+        return SleepOp(this, fd, ms);
+    }
+    VerifyOp verify(int fd, const std::string &name, const std::string &pwd, bool isLogin) {
+        return VerifyOp(this, fd, name, pwd, isLogin);
+    }
+
+    // epoll events of a connection fd
+    void onEvents(int fd, uint32_t events);
+    void cancel(int fd);
+    // coroutines waiting now
+    size_t waiting() const {
+        return waiters_.size();
+    }
+
+private:
+    uint64_t park_(Op *op, std::coroutine_handle<> h);
+    // the operation parked as seq completed, a stale seq is ignored
+    void finish_(int fd, uint64_t seq, int result);
+
+    HeapTimer *timer_;
+    int idBase_;
+    uint64_t seq_;
+    std::unordered_map<int, Op *> waiters_;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "config.h"
+#include "sockopts.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fstream>
+#include <vector>
+#include <functional>
+
+static bool parse(const std::string &s, int *out) {
+    char *end = nullptr;
+    errno = 0;
+    long v = strtol(s.c_str(), &end, 10);
+    if(s.empty() || *end != '\0' || errno == ERANGE || v < INT32_MIN || v > INT32_MAX) {
+        return false;
+    }
+    *out = static_cast<int>(v);
+    return true;
+}
+
+static bool parse(const std::string &s, bool *out) {
+    if(s == "1" || s == "true" || s == "on" || s == "yes") {
+        *out = true;
+    } else if(s == "0" || s == "false" || s == "off" || s == "no") {
+        *out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse(const std::string &s, std::string *out) {
+    *out = s;
+    return true;
+}
+
+static std::string format(int v) {
+    return std::to_string(v);
+}
+
+static std::string format(bool v) {
+    return v ? "true" : "false";
+}
+
+static std::string format(const std::string &v) {
+    return v;
+}
+
+namespace {
+
+struct Option {
+    const char *key;
+    char flag;          // short command line flag, 0: none
+    const char *help;
+    bool secret;        // dump() prints *** instead
+    std::function<bool(Config &, const std::string &)> set;
+    std::function<std::string(const Config &)> get;
+};
+
+template<typename T>
+Option option(const char *key, char flag, T Config::*member, const char *help, bool secret = false) {
+    return {key, flag, help, secret,
+            [member](Config &c, const std::string &v) { return parse(v, &(c.*member)); },
+            [member](const Config &c) { return format(c.*member); }};
+}
+
+const std::vector<Option> &options() {
+    static const std::vector<Option> opts = {
+        option("port", 'p', &Config::port, "listen port, 1024-65535"),
+        option("trig_mode", 'm', &Config::trigMode,
+               "0-3: LT/ET for listen/conn, 4: ET served on the loop, 5: coroutines on the loop"),
+        option("timeout_ms", 0, &Config::timeoutMs, "idle connection timeout, 0: never"),
+        option("linger", 0, &Config::optLinger, "SO_LINGER 1s on close"),
+        option("threads", 0, &Config::threads, "ThreadPool workers"),
+        option("max_conn", 'c', &Config::maxConn, "open connections, at most 65536"),
+        option("max_conn_per_ip", 'i', &Config::maxConnPerIp, "per client address, 0: unlimited"),
+        option("workers", 'w', &Config::workers, "prefork worker processes, 0: single process"),
+        option("reuse_port", 0, &Config::reusePort, "SO_REUSEPORT listener per worker, else shared"),
+        option("io_backend", 'e', &Config::ioBackend, "epoll | uring | uring-sqpoll"),
+        option("sock_profile", 'o', &Config::sockProfile, "default | latency | throughput"),
+        option("numa", 0, &Config::numa, "pin workers/pool threads per node, steer and count accepts by node"),
+        option("inline_file_size", 0, &Config::inlineFileSize,
+               "files up to it sent from memory after the header, larger ones mmapped; 0: always mmap"),
+        option("map_populate_size", 0, &Config::mapPopulateSize,
+               "mmapped files up to it are prefaulted with MAP_POPULATE"),
+        option("map_hugepage_size", 0, &Config::mapHugepageSize,
+               "mmapped files from it are 2 MiB aligned with MADV_HUGEPAGE; 0: never"),
+        option("map_readahead", 0, &Config::mapReadahead,
+               "bytes read ahead of other mmapped files, advised MADV_SEQUENTIAL"),
+        option("user_store", 's', &Config::userStore, "sql | mmap"),
+        option("store_path", 0, &Config::storePath, "file of the mmap user store"),
+        option("sql_port", 0, &Config::sqlPort, "MySQL port"),
+        option("sql_user", 0, &Config::sqlUser, "MySQL user"),
+        option("sql_password", 0, &Config::sqlPwd, "MySQL password", true),
+        option("db_name", 0, &Config::dbName, "MySQL database"),
+        option("sql_pool", 0, &Config::sqlPoolSize, "SqlConnPool connections"),
+        option("async_sql", 0, &Config::asyncSql, "park login/register queries in the poller"),
+        option("sql_timeout_ms", 0, &Config::sqlTimeoutMs, "login/register query deadline, 503 after it"),
+        option("log", 0, &Config::openLog, "write ./log"),
+        option("log_level", 0, &Config::logLevel, "0 debug, 1 info, 2 warn, 3 error"),
+        option("log_queue", 0, &Config::logQueSize, "async log queue size, 0: synchronous"),
+        option("trace_sample", 't', &Config::traceSample, "trace one request in n, 0: off"),
+        option("metrics_path", 0, &Config::metricsPath, "Prometheus metrics, \"\": not served"),
+        option("trace_path", 0, &Config::tracePath, "sampled traces as Chrome trace JSON, \"\": not served"),
+        option("admin_public", 0, &Config::adminPublic,
+               "serve metrics_path and trace_path to any client, else to loopback ones only"),
+    };
+    return opts;
+}
+
+const Option *findOption(const std::string &key) {
+    for(const Option &opt : options()) {
+        if(key == opt.key) {
+            return &opt;
+        }
+    }
+    return nullptr;
+}
+
+const Option *findFlag(char flag) {
+    for(const Option &opt : options()) {
+        if(opt.flag && opt.flag == flag) {
+            return &opt;
+        }
+    }
+    return nullptr;
+}
+
+std::string trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if(begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+} // namespace
+
+bool Config::set(const std::string &key, const std::string &value, std::string *err) {
+    const Option *opt = findOption(key);
+    if(!opt) {
+        *err = "unknown option " + key;
+        return false;
+    }
+    if(!opt->set(*this, value)) {
+        *err = "bad value for " + key + ": " + value;
+        return false;
+    }
+    return true;
+}
+
+bool Config::load(const std::string &path, std::string *err) {
+    std::ifstream in(path);
+    if(!in) {
+        *err = "can not open " + path;
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while(std::getline(in, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if(hash != std::string::npos) {
+            line.erase(hash);
+        }
+        line = trim(line);
+        if(line.empty()) {
+            continue;
+        }
+        size_t eq = line.find('=');
+        if(eq == std::string::npos) {
+            *err = path + ":" + std::to_string(lineNo) + ": expected key = value";
+            return false;
+        }
+        if(!set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)), err)) {
+            *err = path + ":" + std::to_string(lineNo) + ": " + *err;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Config::parseArgs(int argc, char *argv[], bool *printConfig, std::string *err) {
+    *printConfig = false;
+    args.assign(argv, argv + argc);
+    // the file first, so the rest of the command line overrides it
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-f" || arg == "--config") {
+            if(i + 1 >= argc) {
+                *err = arg + " needs a value";
+                return false;
+            }
+            if(!load(argv[++i], err)) {
+                return false;
+            }
+        } else if(arg.compare(0, 9, "--config=") == 0) {
+            if(!load(arg.substr(9), err)) {
+                return false;
+            }
+        }
+    }
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--print-config") {
+            *printConfig = true;
+            continue;
+        }
+        if(arg == "-f" || arg == "--config") {
+            i++;
+            continue;
+        }
+        if(arg.compare(0, 9, "--config=") == 0) {
+            continue;
+        }
+        std::string key;
+        if(arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            key = arg.substr(2);
+            size_t eq = key.find('=');
+            if(eq != std::string::npos) {
+                if(!set(key.substr(0, eq), key.substr(eq + 1), err)) {
+                    return false;
+                }
+                continue;
+            }
+        } else if(arg.size() == 2 && arg[0] == '-' && findFlag(arg[1])) {
+            key = findFlag(arg[1])->key;
+        } else {
+            *err = "unknown argument " + arg;
+            return false;
+        }
+        if(i + 1 >= argc) {
+            *err = arg + " needs a value";
+            return false;
+        }
+        if(!set(key, argv[++i], err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Config::validate(std::string *err) const {
+    SockProfile profile;
+    if(port < 1024 || port > 65535) {
+        *err = "port must be in 1024-65535";
+    } else if(trigMode < 0 || trigMode > 5) {
+        *err = "trig_mode must be in 0-5";
+    } else if(trigMode >= 4 && userStore == "sql" && !asyncSql) {
+        // a blocking query on the loop thread stalls every connection
+        *err = "trig_mode 4 and 5 with user_store=sql need async_sql";
+    } else if(timeoutMs < 0) {
+        *err = "timeout_ms must not be negative";
+    } else if(threads < 1) {
+        *err = "threads must be at least 1";
+    } else if(maxConn < 1 || maxConn > 65536) {
+        *err = "max_conn must be in 1-65536";
+    } else if(workers < 0 || workers > MAX_WORKERS) {
+        *err = "workers must be in 0-" + std::to_string(MAX_WORKERS);
+    } else if(inlineFileSize < 0 || inlineFileSize > MAX_INLINE_FILE) {
+        *err = "inline_file_size must be in 0-" + std::to_string(MAX_INLINE_FILE);
+    } else if(!metricsPath.empty() && metricsPath[0] != '/') {
+        *err = "metrics_path must start with /";
+    } else if(!tracePath.empty() && tracePath[0] != '/') {
+        *err = "trace_path must start with /";
+    } else if(mapPopulateSize < 0 || mapHugepageSize < 0 || mapReadahead < 0) {
+        *err = "map_populate_size, map_hugepage_size and map_readahead must not be negative";
+    } else if(maxConnPerIp < 0) {
+        *err = "max_conn_per_ip must not be negative";
+    } else if(ioBackend != "epoll" && ioBackend != "uring" && ioBackend != "uring-sqpoll") {
+        *err = "io_backend must be epoll, uring or uring-sqpoll";
+    } else if(!SockProfile::find(sockProfile.c_str(), &profile)) {
+        *err = "sock_profile must be default, latency or throughput";
+    } else if(userStore != "sql" && userStore != "mmap") {
+        *err = "user_store must be sql or mmap";
+    } else if(userStore == "mmap" && storePath.empty()) {
+        *err = "store_path must be set for the mmap store";
+    } else if(userStore == "sql" && (sqlPort < 1 || sqlPort > 65535)) {
+        *err = "sql_port must be in 1-65535";
+    } else if(userStore == "sql" && sqlPoolSize < 1) {
+        *err = "sql_pool must be at least 1";
+    } else if(sqlTimeoutMs < 1) {
+        *err = "sql_timeout_ms must be at least 1";
+    } else if(logLevel < 0 || logLevel > 3) {
+        *err = "log_level must be in 0-3";
+    } else if(logQueSize < 0) {
+        *err = "log_queue must not be negative";
+    } else if(traceSample < 0) {
+        *err = "trace_sample must not be negative";
+    } else {
+        return true;
+    }
+    return false;
+}
+
+std::vector<std::string> Config::diff(const Config &other) const {
+    std::vector<std::string> keys;
+    for(const Option &opt : options()) {
+        if(opt.get(*this) != opt.get(other)) {
+            keys.push_back(opt.key);
+        }
+    }
+    return keys;
+}
+
+bool Config::reparse(Config *fresh, std::string *err) const {
+    if(args.empty()) {
+        *err = "command line unknown";
+        return false;
+    }
+    std::vector<std::string> copy = args;
+    std::vector<char *> argv;
+    for(std::string &arg : copy) {
+        argv.push_back(&arg[0]);
+    }
+    bool printConfig = false;
+    return fresh->parseArgs(argv.size(), argv.data(), &printConfig, err) && fresh->validate(err);
+}
+
+std::string Config::dump() const {
+    std::string out;
+    for(const Option &opt : options()) {
+        out += "# ";
+        out += opt.help;
+        if(opt.flag) {
+            out += ", -";
+            out += opt.flag;
+        }
+        out += "\n";
+        out += opt.key;
+        // ends up in logs, a secret has to be set again to load the dump
+        out += " = " + (opt.secret ? std::string("***") : opt.get(*this)) + "\n";
+    }
+    return out;
+}
@@ -0,0 +1,67 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+// Every WebServer tunable. Read from a "key = value" file, then from the
+// command line (--key=value, --key value or the short flags), the later
+// one wins.
+struct Config {
+    static const int MAX_WORKERS = 256;
+    static const int MAX_INLINE_FILE = 1 << 20;
+
+    int port = 5423;
+    int trigMode = 3;           // 0-3: LT/ET for listen/conn, 4: ET served on the loop,
+                                // 5: ET, a coroutine per conn on the loop
+    int timeoutMs = 60000;      // idle connections, 0: never
+    bool optLinger = false;
+    int threads = 8;
+    int maxConn = 65536;
+    int maxConnPerIp = 0;       // 0: unlimited
+    int workers = 0;            // prefork worker processes, 0: serve in this process
+    bool reusePort = true;      // a SO_REUSEPORT listener per worker, else one shared
+    std::string ioBackend = "epoll";        // epoll | uring | uring-sqpoll
+    std::string sockProfile = "default";    // default | latency | throughput
+    bool numa = false;          // place workers and pool threads per node
+    int inlineFileSize = 16384; // files up to it are sent from the FileCache, not mapped
+    int mapPopulateSize = 1 << 20;  // mapped files up to it are prefaulted
+    int mapHugepageSize = 16 << 20; // mapped files from it ask for huge pages, 0: never
+    int mapReadahead = 2 << 20;     // read ahead of the others on mapping
+
+    std::string userStore = "sql";          // sql | mmap
+    std::string storePath = "./users.db";
+    int sqlPort = 3307;
+    std::string sqlUser = "root";
+    std::string sqlPwd = "root";
+    std::string dbName = "webserver";
+    int sqlPoolSize = 12;
+    bool asyncSql = true;
+    int sqlTimeoutMs = 3000;    // a login/register query not answered by then gets 503
+
+    bool openLog = true;
+    int logLevel = 1;
+    int logQueSize = 1024;      // 0: synchronous
+    int traceSample = 0;        // one request in n, 0: off
+    std::string metricsPath = "/metrics";   // "": not served
+    std::string tracePath = "/debug/trace"; // sampled traces as Chrome trace JSON, "": not served
+    bool adminPublic = false;   // the internal endpoints to any client, else loopback only
+
+    // the command line parseArgs got, rerun on reload and restart
+    std::vector<std::string> args;
+    int workerId = -1;          // set by the master in a worker process
+
+    bool load(const std::string &path, std::string *err);
+    bool set(const std::string &key, const std::string &value, std::string *err);
+    // printConfig is set by --print-config
+    bool parseArgs(int argc, char *argv[], bool *printConfig, std::string *err);
+    bool validate(std::string *err) const;
+    // in the file format, loadable again once the secrets are filled in
+    std::string dump() const;
+    // keys whose values differ
+    std::vector<std::string> diff(const Config &other) const;
+    // parses args again into fresh, for a reload
+    bool reparse(Config *fresh, std::string *err) const;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "epoller.h"
+#include "../metrics/metrics.h"
 
 Epoller::Epoller(int maxEvent) : epollFd_(epoll_create(512)), events_(maxEvent) {
     assert(epollFd_ >= 0 && events_.size() > 0);
@@ -15,6 +16,7 @@ bool Epoller::addFd(int fd, uint32_t events) {
     epoll_event ev = {0};
     ev.data.fd = fd;
     ev.events = events;
+    Metrics::instance()->addSyscall(Metrics::SYS_CTL);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
@@ -25,6 +27,7 @@ bool Epoller::modFd(int fd, uint32_t events) {
     epoll_event ev = {0};
     ev.data.fd = fd;
     ev.events = events;
+    Metrics::instance()->addSyscall(Metrics::SYS_CTL);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
@@ -32,10 +35,12 @@ bool Epoller::delFd(int fd) {
     if(fd < 0) {
         return false;
     }
+    Metrics::instance()->addSyscall(Metrics::SYS_CTL);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, 0);
 }
 
 int Epoller::wait(int timeoutMs) {
+    Metrics::instance()->addSyscall(Metrics::SYS_WAIT);
     return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
 }
 
@@ -7,17 +7,22 @@
 #include <vector>
 #include <errno.h>
 
-class Epoller {
+#include "poller.h"
+
+class Epoller : public Poller {
 public:
     explicit Epoller(int maxEvent = 1024);
     ~Epoller();
 
-    bool addFd(int fd, uint32_t events);
-    bool modFd(int fd, uint32_t events);
-    bool delFd(int fd);
-    int wait(int timeoutMs = -1);
-    int getEventFd(size_t i) const;
-    uint32_t getEvents(size_t i) const;
+    bool addFd(int fd, uint32_t events) override;
+    bool modFd(int fd, uint32_t events) override;
+    bool delFd(int fd) override;
+    int wait(int timeoutMs = -1) override;
+    int getEventFd(size_t i) const override;
+    uint32_t getEvents(size_t i) const override;
+    const char *name() const override {
+        return "epoll";
+    }
 private:
     int epollFd_;
     std::vector<struct epoll_event> events_;
@@ -0,0 +1,337 @@
+#include "master.h"
+#include "webserver.h"
+
+#include <sys/prctl.h>
+#include <linux/filter.h>
+
+Master::Master(const Config &config)
+    : config_(config), stopping_(false), workers_(config.workers) {
+    // blocked before any fork, nothing arrives in between
+    sigemptyset(&mask_);
+    sigaddset(&mask_, SIGCHLD);
+    sigaddset(&mask_, SIGTERM);
+    sigaddset(&mask_, SIGINT);
+    sigaddset(&mask_, SIGHUP);
+    sigaddset(&mask_, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask_, &oldMask_);
+    for(Worker &worker : workers_) {
+        worker.pid = 0;
+    }
+}
+
+Master::~Master() {
+    for(int fd : listenFds_) {
+        close(fd);
+    }
+    sigprocmask(SIG_SETMASK, &oldMask_, nullptr);
+}
+
+int Master::run() {
+    if(config_.openLog) {
+        // synchronous: a writer thread would not survive the fork
+        Log::instance()->init(config_.logLevel, "./log", "-master.log", 0);
+    }
+    LOG_INFO("========== Master start ==========");
+    LOG_INFO("Workers: %d, listen socket %s", config_.workers,
+             config_.reusePort ? "SO_REUSEPORT per worker" : "shared");
+    // one slot range per worker, the last one is the master's
+    if(!Metrics::instance()->initShared(config_.workers + 1)) {
+        LOG_ERROR("Metrics shared memory error!");
+        return 1;
+    }
+    Metrics::instance()->setProcess(config_.workers);
+    if(!listen_()) {
+        return 1;
+    }
+    if(config_.numa) {
+        Numa *numa = Numa::instance();
+        if(numa->nodes() <= 1) {
+            LOG_INFO("NUMA: single node, placement off");
+        } else if(config_.reusePort && !steer_()) {
+            LOG_WARN("NUMA: steering by node unavailable, connections hashed");
+        }
+    }
+
+    int status = 0;
+    if(!startAll_()) {
+        status = 1;
+        stopping_ = true;
+        signalAll_(SIGTERM);
+    }
+    for(;;) {
+        bool alive = false;
+        for(const Worker &worker : workers_) {
+            alive = alive || worker.pid > 0;
+        }
+        if(stopping_ && !alive) {
+            break;
+        }
+        siginfo_t info;
+        int sig;
+        int timeMs = waitTimeoutMs_();
+        if(timeMs < 0) {
+            sig = sigwaitinfo(&mask_, &info);
+        } else {
+            struct timespec ts = {timeMs / 1000, (timeMs % 1000) * 1000000L};
+            sig = sigtimedwait(&mask_, &info, &ts);
+        }
+        if(sig == SIGCHLD) {
+            reap_();
+        } else if(sig == SIGTERM || sig == SIGINT) {
+            if(stopping_) {
+                // asked twice, no more waiting for the drain
+                signalAll_(SIGKILL);
+            } else {
+                LOG_INFO("Signal %d, stopping the workers", sig);
+                stopping_ = true;
+                signalAll_(SIGTERM);
+            }
+        } else if(sig == SIGHUP) {
+            reload_();
+        } else if(sig == SIGUSR2) {
+            LOG_WARN("Restart (SIGUSR2) is not supported with workers");
+        }
+        respawnDue_();
+    }
+    LOG_INFO("========== Master exit ==========");
+    return status;
+}
+
+bool Master::listen_() {
+    SockProfile profile;
+    SockProfile::find(config_.sockProfile.c_str(), &profile);
+    int n = config_.reusePort ? config_.workers : 1;
+    for(int i = 0; i < n; i++) {
+        int fd = WebServer::bindListen(config_.port, config_.optLinger, profile, config_.reusePort);
+        if(fd < 0) {
+            return false;
+        }
+        listenFds_.push_back(fd);
+        // joins the SO_REUSEPORT group as socket i
+        if(listen(fd, profile.backlog) < 0) {
+            LOG_ERROR("Listen port: %d error!", config_.port);
+            return false;
+        }
+    }
+    return true;
+}
+
+// a classic BPF program on the SO_REUSEPORT group maps the cpu that
+// received a connection to a worker on that cpu's node; the cpus of a
+// node take turns over its workers
+bool Master::steer_() {
+    Numa *numa = Numa::instance();
+    int n = config_.workers;
+    std::vector<std::vector<int>> onNode(numa->nodeFor(numa->nodes() - 1) + 1);
+    for(int id = 0; id < n; id++) {
+        onNode[numa->nodeFor(id)].push_back(id);
+    }
+    std::vector<struct sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+    for(int i = 0; i < numa->nodes(); i++) {
+        int node = numa->nodeFor(i);
+        const std::vector<int> &cpus = numa->cpus(node);
+        for(size_t c = 0; c < cpus.size() && !onNode[node].empty(); c++) {
+            int id = onNode[node][c % onNode[node].size()];
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpus[c]), 0, 1));
+            code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(id)));
+        }
+    }
+    // out of range: the kernel falls back to the hash
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(n)));
+    if(code.size() > BPF_MAXINSNS) {
+        return false;
+    }
+    struct sock_fprog prog = {static_cast<unsigned short>(code.size()), code.data()};
+    if(setsockopt(listenFds_[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        return false;
+    }
+    LOG_INFO("NUMA: %d nodes, connections steered to the receiving node", numa->nodes());
+    return true;
+}
+
+// fork all workers, true once every one of them serves
+bool Master::startAll_() {
+    int n = static_cast<int>(workers_.size());
+    std::vector<int> ready(n, -1);
+    bool ok = true;
+    for(int id = 0; id < n && ok; id++) {
+        int fds[2];
+        if(pipe2(fds, O_CLOEXEC) < 0) {
+            LOG_ERROR("Worker %d: pipe error!", id);
+            ok = false;
+            break;
+        }
+        ok = spawn_(id, fds[1]);
+        close(fds[1]);
+        ready[id] = fds[0];
+    }
+    // a byte once a worker listens, EOF if it died first
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(READY_WAIT_MS);
+    for(int id = 0; id < n; id++) {
+        if(ready[id] < 0) {
+            continue;
+        }
+        int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - Clock::now()).count();
+        char up = 0;
+        struct pollfd pfd = {ready[id], POLLIN, 0};
+        if(ok && (poll(&pfd, 1, std::max(left, 0)) <= 0 || read(ready[id], &up, 1) != 1)) {
+            LOG_ERROR("Worker %d did not come up", id);
+            ok = false;
+        }
+        close(ready[id]);
+    }
+    return ok;
+}
+
+bool Master::spawn_(int id, int readyFd) {
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if(pid < 0) {
+        LOG_ERROR("Worker %d: fork error!", id);
+        return false;
+    }
+    if(pid > 0) {
+        workers_[id].pid = pid;
+        workers_[id].started = Clock::now();
+        LOG_INFO("Worker %d: pid %d", id, pid);
+        return true;
+    }
+
+    // the worker: goes down with the master
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if(getppid() != master) {
+        _exit(1);
+    }
+    sigprocmask(SIG_SETMASK, &oldMask_, nullptr);
+    if(config_.openLog) {
+        // off the master's file before the server logs its first line
+        static std::string suffix;
+        suffix = "-w" + std::to_string(id) + ".log";
+        Log::instance()->init(config_.logLevel, "./log", suffix.c_str(), 0);
+    }
+    Metrics::instance()->setProcess(id);
+    if(config_.numa) {
+        // before the server starts its threads, they inherit it
+        Numa::instance()->bindThread(Numa::instance()->nodeFor(id));
+    }
+    int listenFd = listenFds_[config_.reusePort ? id : 0];
+    for(int fd : listenFds_) {
+        if(fd != listenFd) {
+            close(fd);
+        }
+    }
+    setenv(WebServer::LISTEN_FD_ENV, std::to_string(listenFd).c_str(), 1);
+    if(readyFd >= 0) {
+        setenv(WebServer::READY_FD_ENV, std::to_string(readyFd).c_str(), 1);
+    }
+    Config config = config_;
+    config.workerId = id;
+    {
+        WebServer server(config);
+        server.start();
+    }
+    exit(0);
+}
+
+void Master::reap_() {
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for(size_t id = 0; id < workers_.size(); id++) {
+            Worker &worker = workers_[id];
+            if(worker.pid != pid) {
+                continue;
+            }
+            worker.pid = 0;
+            if(stopping_) {
+                LOG_INFO("Worker %d exited", static_cast<int>(id));
+                break;
+            }
+            if(WIFSIGNALED(status)) {
+                LOG_ERROR("Worker %d (pid %d) killed by signal %d", static_cast<int>(id), pid, WTERMSIG(status));
+            } else {
+                LOG_WARN("Worker %d (pid %d) exited with %d", static_cast<int>(id), pid, WEXITSTATUS(status));
+            }
+            Clock::time_point now = Clock::now();
+            worker.respawnAt = now;
+            if(now - worker.started < std::chrono::milliseconds(MIN_UPTIME_MS)) {
+                // it failed right away, do not fork in a tight loop
+                worker.respawnAt += std::chrono::milliseconds(RESPAWN_DELAY_MS);
+            }
+            break;
+        }
+    }
+}
+
+void Master::respawnDue_() {
+    if(stopping_) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    for(size_t id = 0; id < workers_.size(); id++) {
+        Worker &worker = workers_[id];
+        if(worker.pid > 0 || worker.respawnAt > now) {
+            continue;
+        }
+        if(spawn_(static_cast<int>(id), -1)) {
+            Metrics::instance()->add(Metrics::WORKER_RESTARTS);
+        } else {
+            worker.respawnAt = now + std::chrono::milliseconds(RESPAWN_DELAY_MS);
+        }
+    }
+}
+
+// ms until the next respawn is due, -1: none waiting
+int Master::waitTimeoutMs_() const {
+    if(stopping_) {
+        return -1;
+    }
+    int timeMs = -1;
+    Clock::time_point now = Clock::now();
+    for(const Worker &worker : workers_) {
+        if(worker.pid > 0) {
+            continue;
+        }
+        int left = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        worker.respawnAt - now).count());
+        if(timeMs < 0 || left < timeMs) {
+            timeMs = left;
+        }
+    }
+    return timeMs;
+}
+
+// the workers reload themselves; the master keeps the new config for
+// the workers it forks from now on
+void Master::reload_() {
+    LOG_INFO("========== Reload ==========");
+    Config fresh;
+    std::string err;
+    if(!config_.reparse(&fresh, &err)) {
+        LOG_ERROR("Reload: %s, config kept", err.c_str());
+    } else {
+        for(const std::string &key : config_.diff(fresh)) {
+            if(key == "workers" || key == "port" || key == "reuse_port") {
+                LOG_WARN("Reload: %s changed, takes effect in a new master", key.c_str());
+            }
+        }
+        fresh.workers = config_.workers;
+        fresh.port = config_.port;
+        fresh.reusePort = config_.reusePort;
+        if(fresh.logLevel != config_.logLevel) {
+            Log::instance()->setLevel(fresh.logLevel);
+        }
+        config_ = fresh;
+    }
+    signalAll_(SIGHUP);
+}
+
+void Master::signalAll_(int sig) {
+    for(const Worker &worker : workers_) {
+        if(worker.pid > 0) {
+            kill(worker.pid, sig);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <vector>
+#include <chrono>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+// Prefork mode: forks config.workers processes, each a whole WebServer
+// with its own loop, pools and caches; nothing is shared but the listen
+// port and the metrics slots. Workers that die are forked again.
+// SIGTERM/SIGINT stop the workers gracefully, SIGHUP is passed on.
+// With numa each worker is placed on a node, and on several nodes the
+// SO_REUSEPORT group hands a connection to a worker on the node that
+// received it.
+class Master {
+public:
+    explicit Master(const Config &config);
+    ~Master();
+
+    // returns the exit status, in the master only: a worker exits itself
+    int run();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Worker {
+        pid_t pid;              // 0: waiting for respawn
+        Clock::time_point started;
+        Clock::time_point respawnAt;
+    };
+
+    bool listen_();
+    bool steer_();
+    bool spawn_(int id, int readyFd);
+    bool startAll_();
+    void reap_();
+    void respawnDue_();
+    void reload_();
+    void signalAll_(int sig);
+    int waitTimeoutMs_() const;
+
+    static const int READY_WAIT_MS = 10000;
+    static const int MIN_UPTIME_MS = 1000;  // dying sooner is a crash loop
+    static const int RESPAWN_DELAY_MS = 1000;
+
+    Config config_;
+    // one shared listener, or a SO_REUSEPORT one per worker: held here,
+    // the group keeps its order and a respawned worker its queue
+    std::vector<int> listenFds_;
+    bool stopping_;
+    sigset_t mask_;     // handled with sigtimedwait
+    sigset_t oldMask_;  // restored in the workers
+    std::vector<Worker> workers_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "numa.h"
+#include "../log/log.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+static const char NODE_DIR[] = "/sys/devices/system/node";
+
+// "0-3,8-11"
+static std::vector<int> parseCpuList(const char *list) {
+    std::vector<int> cpus;
+    const char *p = list;
+    while(*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if(end == p) {
+            break;
+        }
+        long last = first;
+        if(*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        p = (*end == ',') ? end + 1 : end;
+        if(*p == '\n') {
+            break;
+        }
+    }
+    return cpus;
+}
+
+Numa *Numa::instance() {
+    static Numa numa;
+    return &numa;
+}
+
+Numa::Numa() {
+    DIR *dir = opendir(NODE_DIR);
+    struct dirent *entry;
+    while(dir && (entry = readdir(dir))) {
+        int id;
+        char tail;
+        if(sscanf(entry->d_name, "node%d%c", &id, &tail) != 1 || id < 0) {
+            continue;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIR, id);
+        FILE *fp = fopen(path, "r");
+        if(!fp) {
+            continue;
+        }
+        char list[4096] = {0};
+        if(fgets(list, sizeof(list), fp)) {
+            std::vector<int> cpus = parseCpuList(list);
+            if(!cpus.empty()) {
+                if(static_cast<int>(cpus_.size()) <= id) {
+                    cpus_.resize(id + 1);
+                }
+                cpus_[id] = cpus;
+                nodes_.push_back(id);
+            }
+        }
+        fclose(fp);
+    }
+    if(dir) {
+        closedir(dir);
+    }
+    if(nodes_.empty()) {
+        // no sysfs, e.g. in some containers: one node of every cpu
+        cpus_.assign(1, std::vector<int>());
+        for(long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); cpu++) {
+            cpus_[0].push_back(static_cast<int>(cpu));
+        }
+        nodes_.push_back(0);
+    }
+    std::sort(nodes_.begin(), nodes_.end());
+    for(int node : nodes_) {
+        for(int cpu : cpus_[node]) {
+            if(static_cast<int>(nodeOf_.size()) <= cpu) {
+                nodeOf_.resize(cpu + 1, -1);
+            }
+            nodeOf_[cpu] = node;
+        }
+    }
+}
+
+int Numa::nodeOf(int cpu) const {
+    if(cpu < 0 || cpu >= static_cast<int>(nodeOf_.size())) {
+        return -1;
+    }
+    return nodeOf_[cpu];
+}
+
+const std::vector<int> &Numa::cpus(int node) const {
+    return cpus_[node];
+}
+
+bool Numa::bindThread(int node) {
+    if(nodes() <= 1) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus_[node]) {
+        CPU_SET(cpu, &set);
+    }
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        LOG_WARN("NUMA: cpu affinity for node %d error!", node);
+        return false;
+    }
+    // preferred, not bound: a full node falls back to the others
+    const int BITS = sizeof(unsigned long) * 8;
+    unsigned long mask[1024 / (sizeof(unsigned long) * 8)] = {0};
+    if(node >= static_cast<int>(sizeof(mask) * 8)) {
+        return true;
+    }
+    mask[node / BITS] |= 1UL << (node % BITS);
+    // the kernel takes the mask length plus one
+    if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1) < 0) {
+        LOG_WARN("NUMA: memory policy for node %d error!", node);
+        return false;
+    }
+    return true;
+}
+
+int Numa::incomingCpu(int fd) {
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+        return -1;
+    }
+    return cpu;
+}
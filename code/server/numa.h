@@ -0,0 +1,40 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+
+// NUMA topology from /sys/devices/system/node and the few calls placing
+// threads and memory on a node, made directly instead of via libnuma.
+// On a single node (or without sysfs) everything is a no-op.
+class Numa {
+public:
+    static Numa *instance();
+
+    // node ids are sysfs ids, nodes without cpus are skipped
+    int nodes() const {
+        return static_cast<int>(nodes_.size());
+    }
+    // sysfs id of the i-th node, round robin
+    int nodeFor(int i) const {
+        return nodes_[i % nodes_.size()];
+    }
+    // -1: unknown cpu
+    int nodeOf(int cpu) const;
+    const std::vector<int> &cpus(int node) const;
+
+    // the calling thread runs on the node's cpus and allocates from its
+    // memory first; threads it starts afterwards inherit both
+    bool bindThread(int node);
+
+    // cpu that received the traffic of an accepted socket, -1: unknown
+    static int incomingCpu(int fd);
+
+private:
+    Numa();
+
+    std::vector<int> nodes_;
+    std::vector<int> nodeOf_;               // by cpu
+    std::vector<std::vector<int>> cpus_;    // by node id
+};
+
+#endif
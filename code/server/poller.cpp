@@ -0,0 +1,17 @@
+#include "poller.h"
+
+#include <string.h>
+
+#include "epoller.h"
+#include "uringpoller.h"
+
+std::unique_ptr<Poller> Poller::create(const char *backend, int maxEvent) {
+    if(backend && strncmp(backend, "uring", 5) == 0) {
+        std::unique_ptr<UringPoller> poller =
+            std::make_unique<UringPoller>(maxEvent, strcmp(backend, "uring-sqpoll") == 0);
+        if(poller->isOpen()) {
+            return std::move(poller);
+        }
+    }
+    return std::make_unique<Epoller>(maxEvent);
+}
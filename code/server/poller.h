@@ -0,0 +1,28 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+
+// readiness notification backend of the main loop, events use the
+// EPOLL* bits whatever the implementation
+class Poller {
+public:
+    virtual ~Poller() = default;
+
+    virtual bool addFd(int fd, uint32_t events) = 0;
+    virtual bool modFd(int fd, uint32_t events) = 0;
+    virtual bool delFd(int fd) = 0;
+    virtual int wait(int timeoutMs = -1) = 0;
+    virtual int getEventFd(size_t i) const = 0;
+    virtual uint32_t getEvents(size_t i) const = 0;
+    virtual const char *name() const = 0;
+
+    // backend: "epoll", "uring" or "uring-sqpoll";
+    // io_uring falls back to epoll when the kernel does not allow it
+    static std::unique_ptr<Poller> create(const char *backend, int maxEvent = 1024);
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "sockopts.h"
+#include "../log/log.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const SockProfile PRESETS[] = {
+    // the options the server always had
+    {"default", 6, 0, 0, false, false, 0, 0, 0},
+    // small responses: one writev goes out at once, the unsent queue
+    // stays short so a response is not stuck behind a big one. keeps the
+    // default backlog and no defer accept, both queue connections longer
+    {"latency", 6, 0, 256, true, false, 0, 0, 16384},
+    // big files: full segments, fixed large buffers
+    {"throughput", 1024, 1, 256, false, true, 1 << 20, 1 << 20, 0},
+};
+
+bool SockProfile::find(const char *name, SockProfile *profile) {
+    for(const SockProfile &p : PRESETS) {
+        if(strcmp(p.name, name) == 0) {
+            *profile = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool setOpt(int fd, int level, int opt, int val, const char *optName) {
+    if(setsockopt(fd, level, opt, &val, sizeof(val)) < 0) {
+        LOG_WARN("setsockopt %s = %d error!", optName, val);
+        return false;
+    }
+    return true;
+}
+
+bool SockProfile::applyListen(int fd) const {
+    bool ok = true;
+    // the buffers size the window scale, they must be set before listen()
+    if(sndBuf > 0) {
+        ok &= setOpt(fd, SOL_SOCKET, SO_SNDBUF, sndBuf, "SO_SNDBUF");
+    }
+    if(rcvBuf > 0) {
+        ok &= setOpt(fd, SOL_SOCKET, SO_RCVBUF, rcvBuf, "SO_RCVBUF");
+    }
+    if(deferAccept > 0) {
+        ok &= setOpt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, deferAccept, "TCP_DEFER_ACCEPT");
+    }
+    if(fastOpen > 0) {
+        ok &= setOpt(fd, IPPROTO_TCP, TCP_FASTOPEN, fastOpen, "TCP_FASTOPEN");
+    }
+    if(noDelay) {
+        ok &= setOpt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if(notSentLowat > 0) {
+        ok &= setOpt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notSentLowat, "TCP_NOTSENT_LOWAT");
+    }
+    return ok;
+}
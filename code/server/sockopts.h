@@ -0,0 +1,24 @@
+#ifndef SOCK_OPTS_H
+#define SOCK_OPTS_H
+
+// Named set of TCP options. Everything but TCP_CORK is set on the listen
+// socket: Linux copies the options into each accepted socket, so a new
+// connection costs no setsockopt calls.
+struct SockProfile {
+    const char *name;
+    int backlog;        // listen() queue
+    int deferAccept;    // TCP_DEFER_ACCEPT seconds, wake on the first data, 0: off
+    int fastOpen;       // TCP_FASTOPEN queue, data in the SYN, 0: off
+    bool noDelay;       // TCP_NODELAY, no Nagle wait on the last segment
+    bool cork;          // TCP_CORK while a response takes several writev
+    int sndBuf;         // SO_SNDBUF/SO_RCVBUF bytes, 0: kernel autotuning
+    int rcvBuf;
+    int notSentLowat;   // TCP_NOTSENT_LOWAT bytes, 0: off
+
+    // false: no preset of that name
+    static bool find(const char *name, SockProfile *profile);
+    // set before listen(), false if an option is refused
+    bool applyListen(int fd) const;
+};
+
+#endif
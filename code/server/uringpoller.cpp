@@ -0,0 +1,299 @@
+#include "uringpoller.h"
+#include "../metrics/metrics.h"
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#include <algorithm>
+
+// bits poll understands, EPOLLONESHOT/EPOLLET only select the request kind
+static const uint32_t POLL_BITS = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+
+UringPoller::UringPoller(int maxEvent, bool sqPoll)
+    : ringFd_(-1), sqPoll_(false), owner_(std::this_thread::get_id()),
+      ringPtr_(MAP_FAILED), ringSize_(0), sqes_(nullptr), sqesSize_(0),
+      sqeTail_(0), waiting_(false), events_(maxEvent) {
+    assert(maxEvent > 0);
+    // SQPOLL needs privileges on older kernels, fall back to plain submission
+    if(!(sqPoll && setup_(1024, true))) {
+        setup_(1024, false);
+    }
+}
+
+UringPoller::~UringPoller() {
+    if(sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if(ringPtr_ != MAP_FAILED) {
+        munmap(ringPtr_, ringSize_);
+    }
+    if(ringFd_ >= 0) {
+        close(ringFd_);
+    }
+}
+
+bool UringPoller::setup_(unsigned entries, bool sqPoll) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // room for every multishot completion of a busy wait()
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    p.cq_entries = entries * 8;
+    if(sqPoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 100; // ms before the kernel thread sleeps
+    }
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0) {
+        return false;
+    }
+    // single ring mmap, no dropped completions, wait with timeout (5.11),
+    // multishot poll (5.13, same release as RSRC_TAGS)
+    const unsigned need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                        | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+    if((p.features & need) != need) {
+        close(fd);
+        return false;
+    }
+    ringSize_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                         p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    ringPtr_ = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ringPtr_ == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    sqesSize_ = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        munmap(ringPtr_, ringSize_);
+        ringPtr_ = MAP_FAILED;
+        close(fd);
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    char *ring = static_cast<char *>(ringPtr_);
+    sqHead_ = reinterpret_cast<unsigned *>(ring + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(ring + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned *>(ring + p.sq_off.ring_mask);
+    sqEntries_ = reinterpret_cast<unsigned *>(ring + p.sq_off.ring_entries);
+    sqFlags_ = reinterpret_cast<unsigned *>(ring + p.sq_off.flags);
+    sqArray_ = reinterpret_cast<unsigned *>(ring + p.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned *>(ring + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(ring + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned *>(ring + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(ring + p.cq_off.cqes);
+
+    // sqe i always sits in slot i
+    for(unsigned i = 0; i < p.sq_entries; i++) {
+        sqArray_[i] = i;
+    }
+    sqeTail_ = *sqTail_;
+    ringFd_ = fd;
+    sqPoll_ = sqPoll;
+    return true;
+}
+
+UringPoller::FdState &UringPoller::state_(int fd) {
+    if(static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(std::max<size_t>(fd + 1, fds_.size() * 2), FdState{0, 0, false});
+    }
+    return fds_[fd];
+}
+
+// called with mtx_ held
+io_uring_sqe *UringPoller::getSqe_() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(sqeTail_ - head >= *sqEntries_) {
+        // full: push what is queued to the kernel first
+        publish_();
+        enter_(sqPoll_ ? 0 : sqeTail_ - head, 0, sqPoll_ ? IORING_ENTER_SQ_WAKEUP : 0, -1);
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if(sqeTail_ - head >= *sqEntries_) {
+            return nullptr;
+        }
+    }
+    io_uring_sqe *sqe = &sqes_[sqeTail_ & *sqMask_];
+    sqeTail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void UringPoller::publish_() {
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+}
+
+void UringPoller::arm_(int fd, FdState &st, uint32_t events) {
+    io_uring_sqe *sqe = getSqe_();
+    if(!sqe) {
+        return;
+    }
+    st.gen++;
+    st.events = events;
+    st.armed = true;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events & POLL_BITS;
+    sqe->len = (events & EPOLLONESHOT) ? 0 : IORING_POLL_ADD_MULTI;
+    sqe->user_data = userData_(fd, st.gen);
+}
+
+void UringPoller::disarm_(int fd, FdState &st) {
+    if(st.armed) {
+        io_uring_sqe *sqe = getSqe_();
+        if(sqe) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = userData_(fd, st.gen);
+            sqe->user_data = CTRL;
+        }
+        st.armed = false;
+    }
+    // whatever is still in flight for the old request is stale now
+    st.gen++;
+}
+
+int UringPoller::enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs) {
+    Metrics::instance()->addSyscall(minComplete > 0 ? Metrics::SYS_WAIT : Metrics::SYS_CTL);
+    if(minComplete > 0 && timeoutMs >= 0) {
+        __kernel_timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                       flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, nullptr, _NSIG / 8);
+}
+
+// the loop's own changes wait for the next wait(), so do a worker's
+// while the loop is awake; with the loop asleep in the kernel they are
+// submitted right away, or picked up by the SQPOLL thread
+void UringPoller::commit_() {
+    publish_();
+    if(std::this_thread::get_id() == owner_) {
+        return;
+    }
+    if(!sqPoll_) {
+        if(!waiting_) {
+            return;
+        }
+        enter_(sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE), 0, 0, -1);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(sqFlags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+        enter_(0, 0, IORING_ENTER_SQ_WAKEUP, -1);
+    }
+}
+
+bool UringPoller::addFd(int fd, uint32_t events) {
+    if(fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    FdState &st = state_(fd);
+    disarm_(fd, st);
+    arm_(fd, st, events);
+    commit_();
+    return st.armed;
+}
+
+bool UringPoller::modFd(int fd, uint32_t events) {
+    if(fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    FdState &st = state_(fd);
+    // a fired oneshot request is already gone, otherwise replace it
+    disarm_(fd, st);
+    arm_(fd, st, events);
+    commit_();
+    return st.armed;
+}
+
+bool UringPoller::delFd(int fd) {
+    if(fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    disarm_(fd, state_(fd));
+    commit_();
+    return true;
+}
+
+int UringPoller::wait(int timeoutMs) {
+    unsigned toSubmit = 0;
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        publish_();
+        if(sqPoll_) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if(__atomic_load_n(sqFlags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+        } else {
+            toSubmit = sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        }
+        // from here on a worker submits its own requests
+        waiting_ = true;
+    }
+    int ret = enter_(toSubmit, 1, flags, timeoutMs);
+    int err = errno;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    waiting_ = false;
+    if(ret < 0 && err != ETIME && err != EINTR && err != EBUSY) {
+        return -1;
+    }
+    int cnt = 0;
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    // completions past events_.size() stay for the next wait()
+    while(head != tail && cnt < static_cast<int>(events_.size())) {
+        const io_uring_cqe &cqe = cqes_[head & *cqMask_];
+        head++;
+        if(cqe.user_data == CTRL) {
+            continue;
+        }
+        int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32);
+        if(static_cast<size_t>(fd) >= fds_.size() || fds_[fd].gen != gen) {
+            continue;
+        }
+        FdState &st = fds_[fd];
+        if(!(cqe.flags & IORING_CQE_F_MORE)) {
+            st.armed = false;
+            // a multishot request ended on its own, e.g. on overflow
+            if(!(st.events & EPOLLONESHOT) && cqe.res >= 0) {
+                arm_(fd, st, st.events);
+            }
+        }
+        if(cqe.res > 0) {
+            events_[cnt].data.fd = fd;
+            events_[cnt].events = static_cast<uint32_t>(cqe.res);
+            cnt++;
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return cnt;
+}
+
+int UringPoller::getEventFd(size_t i) const {
+    assert(0 <= i && i < events_.size());
+    return events_[i].data.fd;
+}
+
+uint32_t UringPoller::getEvents(size_t i) const {
+    assert(0 <= i && i < events_.size());
+    return events_[i].events;
+}
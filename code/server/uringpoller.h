@@ -0,0 +1,80 @@
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "poller.h"
+
+// Poller on top of io_uring poll requests, raw syscalls, no liburing.
+// Registrations are SQEs, submitted together with the next wait() in a
+// single io_uring_enter: the loop's always, a worker's too unless the
+// loop is asleep in the kernel already, then the worker enters itself.
+// With SQPOLL the kernel picks them all up without a syscall.
+// Fds without EPOLLONESHOT (the listen socket) get a multishot poll.
+class UringPoller : public Poller {
+public:
+    explicit UringPoller(int maxEvent = 1024, bool sqPoll = false);
+    ~UringPoller();
+
+    // false: io_uring is missing or disabled, use epoll instead
+    bool isOpen() const {
+        return ringFd_ >= 0;
+    }
+
+    bool addFd(int fd, uint32_t events) override;
+    bool modFd(int fd, uint32_t events) override;
+    bool delFd(int fd) override;
+    int wait(int timeoutMs = -1) override;
+    int getEventFd(size_t i) const override;
+    uint32_t getEvents(size_t i) const override;
+    const char *name() const override {
+        return sqPoll_ ? "uring-sqpoll" : "uring";
+    }
+
+private:
+    struct FdState {
+        uint32_t gen;       // bumped on every new poll request of the fd
+        uint32_t events;
+        bool armed;         // a poll request is in flight
+    };
+
+    bool setup_(unsigned entries, bool sqPoll);
+    FdState &state_(int fd);
+    void arm_(int fd, FdState &st, uint32_t events);
+    void disarm_(int fd, FdState &st);
+    io_uring_sqe *getSqe_();
+    void publish_();
+    void commit_();
+    int enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs);
+
+    static uint64_t userData_(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+    // user_data of poll removals, their completions are dropped
+    static const uint64_t CTRL = ~0ULL;
+
+    int ringFd_;
+    bool sqPoll_;
+    std::thread::id owner_;
+
+    void *ringPtr_;
+    size_t ringSize_;
+    io_uring_sqe *sqes_;
+    size_t sqesSize_;
+
+    unsigned *sqHead_, *sqTail_, *sqMask_, *sqEntries_, *sqFlags_, *sqArray_;
+    unsigned *cqHead_, *cqTail_, *cqMask_;
+    io_uring_cqe *cqes_;
+
+    std::mutex mtx_;
+    unsigned sqeTail_;      // local tail, published by publish_()
+    bool waiting_;          // the loop is in wait(), it submits nothing until back
+    std::vector<FdState> fds_;
+    std::vector<struct epoll_event> events_;
+};
+
+#endif
@@ -1,53 +1,328 @@
 #include "webserver.h"
 
-WebServer::WebServer(
-    int port, int trigMode, int timeoutMS, bool optLinger,
-    int sqlPort, const char* sqlUser, const char* sqlPwd,
-    const char* dbName, int connPoolNum, int threadNum,
-    bool openLog, int logLevel, int logQueSize)
-    : port_(port), openLinger_(optLinger), timeoutMS_(timeoutMS),
-    isClose_(false), timer_(std::make_unique<HeapTimer>()),
-        threadpool_(std::make_unique<ThreadPool>(threadNum)),
-        epoller_(std::make_unique<Epoller>()) {
+int WebServer::signalFd_ = -1;
+
+// numa in a single process: pool thread i goes to node i round robin;
+// a prefork worker is placed as a whole by the master
+static std::function<void(int)> poolPlacement(const Config &config) {
+    if(!config.numa || config.workerId >= 0 || Numa::instance()->nodes() <= 1) {
+        return nullptr;
+    }
+    return [](int id) {
+        Numa *numa = Numa::instance();
+        numa->bindThread(numa->nodeFor(id));
+    };
+}
+
+WebServer::WebServer(const Config &config)
+    : port_(config.port), openLinger_(config.optLinger), timeoutMS_(config.timeoutMs),
+    isClose_(false), loopIO_(false), coroIO_(false), listenFd_(-1), acceptPending_(false),
+    inherited_(false), draining_(false), restartFd_(-1), restartPid_(-1),
+    maxConn_(std::min(config.maxConn, MAX_FD)), maxConnPerIp_(config.maxConnPerIp),
+    timer_(std::make_unique<HeapTimer>()),
+        coLoop_(std::make_unique<CoLoop>(timer_.get(), MAX_FD)),
+        threadpool_(std::make_unique<ThreadPool>(config.threads, poolPlacement(config))),
+        epoller_(Poller::create(config.ioBackend.c_str())), config_(config) {
             
+    // a client gone while its response is written must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    // kept in reserve for EMFILE
+    idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    HttpConn::draining = false;
     srcDir_ = getcwd(nullptr, 256);
     assert(srcDir_);
     strcat(srcDir_, "/resources/");
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    FileCache::instance()->init(srcDir_);
+    FileCache::instance()->setInlineSize(config.inlineFileSize);
+    FileCache::instance()->setMapPolicy(config.mapPopulateSize, config.mapHugepageSize, config.mapReadahead);
+    ErrorPages::instance()->load(srcDir_);
 
-    // init sql connection pool
-    SqlConnPool::instance()->init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    if(config.userStore == "mmap") {
+        // embedded store, no database needed
+        std::unique_ptr<MmapUserStore> store = std::make_unique<MmapUserStore>();
+        if(!store->open(config.storePath.c_str())) {
+            isClose_ = true;
+        }
+        userStore_ = std::move(store);
+    } else {
+        // init sql connection pool
+        SqlConnPool::instance()->init("localhost", config.sqlPort, config.sqlUser.c_str(),
+                                      config.sqlPwd.c_str(), config.dbName.c_str(), config.sqlPoolSize,
+                                      500, config.sqlTimeoutMs);
+        if(config.asyncSql) {
+            // login/register queries are parked in the epoller instead of a worker
+            SqlAsync::instance()->init(epoller_.get(), config.sqlTimeoutMs);
+        }
+        if(config.trigMode >= 4 && !SqlAsync::instance()->isEnabled()) {
+            // the loop thread would run the queries itself
+            LOG_ERROR("trig_mode %d: the MySQL client lacks the non-blocking API, "
+                      "use user_store=mmap or trig_mode 0-3", config.trigMode);
+            isClose_ = true;
+        }
+        userStore_ = std::make_unique<SqlUserStore>();
+    }
+    HttpRequest::userStore = userStore_.get();
+    HttpRequest::asyncVerify = SqlAsync::instance()->isEnabled();
+    if(config.workers > 0) {
+        // every prefork worker has its own cache: a user registered through
+        // another worker would stay unknown here for the negative ttl
+        UserCache::instance()->init(UserCache::CAPACITY, UserCache::TTL_MS, 0);
+    } else {
+        UserCache::instance()->init();
+    }
+    initMetrics_();
+    initRoutes_();
+    // one request in traceSample is traced, 0: off
+    Tracer::instance()->init(config.traceSample);
     // init event and listen socket
-    initEventMode_(trigMode);
-    if(!initSocket_()) {
+    initEventMode_(config.trigMode);
+    bool knownProfile = SockProfile::find(config.sockProfile.c_str(), &sockProfile_);
+    if(!knownProfile) {
+        SockProfile::find("default", &sockProfile_);
+    }
+    HttpConn::cork = sockProfile_.cork;
+    if(!initSocket_() || !initSignals_()) {
         isClose_ = true;
     }
 
-    if(openLog) {
-        Log::instance()->init(logLevel, "./log", ".log", logQueSize);
+    if(config.openLog) {
+        // Log keeps the pointer; a prefork worker has a file of its own
+        static std::string logSuffix;
+        logSuffix = config.workerId >= 0 ? "-w" + std::to_string(config.workerId) + ".log" : ".log";
+        Log::instance()->init(config.logLevel, "./log", logSuffix.c_str(), config.logQueSize);
         if(isClose_) { 
             LOG_ERROR("========== Server init error! ==========");
         } else {
             LOG_INFO("========== Server init ==========");
-            LOG_INFO("Port: %d, OpenLinger: %s", port_, optLinger ? "true" : "false");
+            LOG_INFO("Port: %d, OpenLinger: %s%s", port_, config.optLinger ? "true" : "false",
+                                inherited_ ? ", listen socket inherited" : "");
+            if(config.workerId >= 0) {
+                LOG_INFO("Worker %d of %d, listen socket %s", config.workerId, config.workers,
+                         config.reusePort ? "SO_REUSEPORT" : "shared");
+            }
+            LOG_INFO("IO backend: %s", epoller_->name());
+            if(config.ioBackend != epoller_->name()) {
+                LOG_WARN("IO backend %s unavailable, using %s", config.ioBackend.c_str(), epoller_->name());
+            }
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                                 (listenEvent_ & EPOLLET) ? "ET" : "LT",
                                 (connEvent_ & EPOLLET) ? "ET" : "LT");
-            LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("LogSys level: %d", config.logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", config.sqlPoolSize, config.threads);
+            LOG_INFO("Max conns: %d, per IP: %d", maxConn_, maxConnPerIp_);
+            if(!knownProfile) {
+                LOG_WARN("Socket profile %s unknown, using default", config.sockProfile.c_str());
+            }
+            LOG_INFO("Socket profile: %s, backlog %d, defer accept %ds, fastopen %d, nodelay %s, "
+                     "cork %s, sndbuf %d, rcvbuf %d, notsent lowat %d",
+                     sockProfile_.name, sockProfile_.backlog, sockProfile_.deferAccept,
+                     sockProfile_.fastOpen, sockProfile_.noDelay ? "on" : "off",
+                     sockProfile_.cork ? "on" : "off", sockProfile_.sndBuf, sockProfile_.rcvBuf,
+                     sockProfile_.notSentLowat);
+            LOG_INFO("UserStore: %s, verify: %s, UserCache: %s", userStore_->name(),
+                                HttpRequest::asyncVerify ? "async" : "sync",
+                                UserCache::instance()->isEnabled() ? "on" : "off");
+            LOG_INFO("Trace sample: %s%d", config.traceSample > 0 ? "1/" : "", config.traceSample);
+            if(config.numa) {
+                Numa *numa = Numa::instance();
+                if(numa->nodes() <= 1) {
+                    LOG_INFO("NUMA: single node, placement off");
+                } else if(config.workerId >= 0) {
+                    LOG_INFO("NUMA: %d nodes, worker on node %d", numa->nodes(),
+                             numa->nodeFor(config.workerId));
+                } else {
+                    LOG_INFO("NUMA: %d nodes, pool threads round robin, prefer workers = %d",
+                             numa->nodes(), numa->nodes());
+                }
+            }
         }
     }
+    notifyReady_();
+}
+
+WebServer::WebServer(
+    int port, int trigMode, int timeoutMS, bool optLinger,
+    int sqlPort, const char* sqlUser, const char* sqlPwd,
+    const char* dbName, int connPoolNum, int threadNum,
+    bool openLog, int logLevel, int logQueSize,
+    bool asyncSql, const char* userStore, const char* storePath, int traceSample,
+    const char* ioBackend, int maxConn, int maxConnPerIp, const char* sockProfile)
+    : WebServer(makeConfig_(port, trigMode, timeoutMS, optLinger, sqlPort, sqlUser, sqlPwd,
+                            dbName, connPoolNum, threadNum, openLog, logLevel, logQueSize,
+                            asyncSql, userStore, storePath, traceSample, ioBackend,
+                            maxConn, maxConnPerIp, sockProfile)) {
+}
+
+Config WebServer::makeConfig_(
+    int port, int trigMode, int timeoutMS, bool optLinger,
+    int sqlPort, const char* sqlUser, const char* sqlPwd,
+    const char* dbName, int connPoolNum, int threadNum,
+    bool openLog, int logLevel, int logQueSize,
+    bool asyncSql, const char* userStore, const char* storePath, int traceSample,
+    const char* ioBackend, int maxConn, int maxConnPerIp, const char* sockProfile) {
+    Config c;
+    c.port = port;
+    c.trigMode = trigMode;
+    c.timeoutMs = timeoutMS;
+    c.optLinger = optLinger;
+    c.sqlPort = sqlPort;
+    c.sqlUser = sqlUser;
+    c.sqlPwd = sqlPwd;
+    c.dbName = dbName;
+    c.sqlPoolSize = connPoolNum;
+    c.threads = threadNum;
+    c.openLog = openLog;
+    c.logLevel = logLevel;
+    c.logQueSize = logQueSize;
+    c.asyncSql = asyncSql;
+    c.userStore = userStore;
+    c.storePath = storePath;
+    c.traceSample = traceSample;
+    c.ioBackend = ioBackend;
+    c.maxConn = maxConn;
+    c.maxConnPerIp = maxConnPerIp;
+    c.sockProfile = sockProfile;
+    return c;
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    // the gauges point into this server
+    Metrics::instance()->clearGauges();
+    if(listenFd_ >= 0) {
+        close(listenFd_);
+    }
+    if(signalFd_ >= 0) {
+        signal(SIGHUP, SIG_DFL);
+        signal(SIGUSR2, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signalFd_ = -1;
+        close(sigPipe_[0]);
+        close(sigPipe_[1]);
+    }
+    if(idleFd_ >= 0) {
+        close(idleFd_);
+    }
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::instance()->closePool();
 }
 
+// state owned by other components, sampled when /metrics is scraped
+void WebServer::initMetrics_() {
+    Metrics *metrics = Metrics::instance();
+    metrics->addGauge("tws_connections", "Open client connections.",
+        [] { return static_cast<double>(HttpConn::userCount); });
+    ThreadPool *pool = threadpool_.get();
+    metrics->addGauge("tws_threadpool_queue_depth", "Tasks waiting for a worker.",
+        [pool] { return static_cast<double>(pool->queueSize()); });
+    if(strcmp(userStore_->name(), "sql") == 0) {
+        SqlConnPool *sql = SqlConnPool::instance();
+        metrics->addGauge("tws_sqlpool_free_connections", "Idle connections in the SqlConnPool.",
+            [sql] { return static_cast<double>(sql->getFreeConnCount()); });
+        metrics->addGauge("tws_sqlpool_waits_total", "getConn calls that had to wait.",
+            [sql] { return static_cast<double>(sql->waitCount()); }, true);
+        metrics->addGauge("tws_sqlpool_timeouts_total", "getConn calls that gave up waiting.",
+            [sql] { return static_cast<double>(sql->timeoutCount()); }, true);
+        metrics->addGauge("tws_sqlpool_reconnects_total", "Reconnected pool connections.",
+            [sql] { return static_cast<double>(sql->reconnectCount()); }, true);
+    }
+    if(config_.trigMode == 5) {
+        CoLoop *coLoop = coLoop_.get();
+        metrics->addGauge("tws_coroutines_waiting", "Connection coroutines parked on I/O, a query or a sleep.",
+            [coLoop] { return static_cast<double>(coLoop->waiting()); });
+    }
+    if(config_.numa) {
+        Numa *numa = Numa::instance();
+        metrics->setNumaNodes(numa->nodeFor(numa->nodes() - 1) + 1);
+    }
+    UserCache *cache = UserCache::instance();
+    metrics->addGauge("tws_usercache_hits_total", "User cache hits.",
+        [cache] { return static_cast<double>(cache->hits()); }, true);
+    metrics->addGauge("tws_usercache_negative_hits_total", "User cache hits on unknown users.",
+        [cache] { return static_cast<double>(cache->negativeHits()); }, true);
+    metrics->addGauge("tws_usercache_misses_total", "User cache misses.",
+        [cache] { return static_cast<double>(cache->misses()); }, true);
+    metrics->addGauge("tws_usercache_evictions_total", "User cache evictions.",
+        [cache] { return static_cast<double>(cache->evictions()); }, true);
+    metrics->addGauge("tws_usercache_entries", "Entries in the user cache.",
+        [cache] { return static_cast<double>(cache->size()); });
+    FileCache *files = FileCache::instance();
+    metrics->addGauge("tws_filecache_hits_total", "Resolved paths served from the file cache.",
+        [files] { return static_cast<double>(files->hits()); }, true);
+    metrics->addGauge("tws_filecache_misses_total", "Paths resolved with openat2.",
+        [files] { return static_cast<double>(files->misses()); }, true);
+    metrics->addGauge("tws_filecache_evictions_total", "File cache evictions.",
+        [files] { return static_cast<double>(files->evictions()); }, true);
+    metrics->addGauge("tws_filecache_entries", "Entries in the file cache.",
+        [files] { return static_cast<double>(files->size()); });
+    metrics->addGauge("tws_filecache_revalidations_total", "Expired entries kept, their file unchanged.",
+        [files] { return static_cast<double>(files->revalidations()); }, true);
+    // of this process; mapped files fault here, not in a read()
+    metrics->addGauge("tws_page_faults_minor_total", "Page faults served without I/O.",
+        [] { return static_cast<double>(pageFaults_(false)); }, true);
+    metrics->addGauge("tws_page_faults_major_total", "Page faults that waited for I/O.",
+        [] { return static_cast<double>(pageFaults_(true)); }, true);
+}
+
+long WebServer::pageFaults_(bool major) {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    return major ? usage.ru_majflt : usage.ru_minflt;
+}
+
+// everything else is a file under srcDir_
+void WebServer::initRoutes_() {
+    Router *router = Router::instance();
+    router->add("*", "/", [](HttpRequest &request, const Router::Params &, Router::Reply *) {
+        request.path() = "/index.html";
+    });
+    for(const char *page : {"/index", "/welcome", "/video", "/picture"}) {
+        router->add("*", page, [](HttpRequest &request, const Router::Params &, Router::Reply *) {
+            request.path() += ".html";
+        });
+    }
+    // the page, or a form posted to it checked against the user store
+    for(bool isLogin : {true, false}) {
+        std::string page = isLogin ? "/login.html" : "/register.html";
+        Router::Handler user = [page, isLogin](HttpRequest &request, const Router::Params &, Router::Reply *) {
+            request.path() = page;
+            if(request.hasForm()) {
+                request.verifyUser(isLogin);
+            }
+        };
+        router->add("*", page, user);
+        router->add("*", page.substr(0, page.size() - 5), user);
+    }
+    // internal: a client that may not see them gets the 404 of a missing file
+    bool adminPublic = config_.adminPublic;
+    if(!config_.metricsPath.empty()) {
+        router->add("GET", config_.metricsPath, [adminPublic](HttpRequest &request, const Router::Params &,
+                                                              Router::Reply *reply) {
+            if(!adminPublic && !request.isLoopback()) {
+                return;
+            }
+            reply->body = Metrics::instance()->render();
+            reply->type = "text/plain; version=0.0.4";
+        });
+    }
+    if(!config_.tracePath.empty()) {
+        // the paths of other clients' requests, never public by default
+        router->add("GET", config_.tracePath, [adminPublic](HttpRequest &request, const Router::Params &,
+                                                            Router::Reply *reply) {
+            if(!adminPublic && !request.isLoopback()) {
+                return;
+            }
+            reply->body = Tracer::instance()->exportChrome();
+            reply->type = "application/json";
+        });
+    }
+}
+
 void WebServer::initEventMode_(int trigMode) {
     listenEvent_ = EPOLLRDHUP;    
     connEvent_ = EPOLLONESHOT | EPOLLRDHUP;    
@@ -65,6 +340,19 @@ void WebServer::initEventMode_(int trigMode) {
         listenEvent_ |= EPOLLET;
         connEvent_ |= EPOLLET;
         break;
+    case 4:
+        // loop mode: registered once for EPOLLIN | EPOLLOUT, no re-arming
+        listenEvent_ |= EPOLLET;
+        connEvent_ = EPOLLRDHUP | EPOLLET;
+        loopIO_ = true;
+        break;
+    case 5:
+        // the same registration, the events resume coroutines
+        listenEvent_ |= EPOLLET;
+        connEvent_ = EPOLLRDHUP | EPOLLET;
+        loopIO_ = true;
+        coroIO_ = true;
+        break;
     default:
         listenEvent_ |= EPOLLET;
         connEvent_ |= EPOLLET;
@@ -81,21 +369,60 @@ void WebServer::start() {
     }
     std::string opt;
     while(!isClose_) {
-        if(timeoutMS_ > 0) {
+        timeMS = -1;
+        if(timeoutMS_ > 0 || draining_ || coroIO_) {
             // get the next timeout waiting event
             // (at least before this time, no users will expire
             // and every time the timeout connection closed,
             // a new request needs to come in)
             timeMS = timer_->getNextTick();
         }
+        if(SqlAsync::instance()->isEnabled()) {
+            // query deadlines and the client library's own timeouts
+            int sqlMS = SqlAsync::instance()->tick(sqlWake_);
+            for(int fd : sqlWake_) {
+                dealSql_(fd, 0);
+            }
+            timeMS = timeMS < 0 ? sqlMS : std::min(timeMS, sqlMS);
+        }
+        if(acceptPending_ || (draining_ && HttpConn::userCount == 0)) {
+            // the last accept batch left clients in the queue, or the
+            // timers just closed the last client of a drain
+            timeMS = 0;
+        }
+        if(restartFd_ >= 0) {
+            // wake up in time to give up on the new process
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            restartDeadline_ - std::chrono::steady_clock::now()).count();
+            left = std::max<decltype(left)>(left, 0);
+            timeMS = timeMS < 0 ? left : std::min<decltype(left)>(timeMS, left);
+        }
         int eventCnt = epoller_->wait(timeMS);
         for(int i = 0; i < eventCnt; i++) {
             int fd = epoller_->getEventFd(i);
             uint32_t events = epoller_->getEvents(i);
             if(fd == listenFd_) {
                 dealListen_();
+            } else if(fd == sigPipe_[0]) {
+                dealSignal_();
+            } else if(fd == restartFd_) {
+                finishRestart_();
+            } else if(SqlAsync::instance()->isSqlFd(fd)) {
+                dealSql_(fd, events);
             } else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 closeConn_(&users_[fd]);
+            } else if(coroIO_) {
+                coLoop_->onEvents(fd, events);
+            } else if(loopIO_) {
+                assert(users_.count(fd) > 0);
+                HttpConn *client = &users_[fd];
+                // both bits may come with one edge
+                if(events & EPOLLOUT) {
+                    onLoopWrite_(client);
+                }
+                if((events & EPOLLIN) && !client->isClose()) {
+                    onLoopRead_(client);
+                }
             } else if(events & EPOLLIN) {
                 assert(users_.count(fd) > 0);
                 dealRead_(&users_[fd]);
@@ -106,58 +433,164 @@ void WebServer::start() {
                 LOG_ERROR("Unexpected event");
             }
         }
+        if(acceptPending_) {
+            dealListen_();
+        }
+        if(restartFd_ >= 0 && std::chrono::steady_clock::now() >= restartDeadline_) {
+            finishRestart_();
+        }
+        if(draining_ && HttpConn::userCount == 0) {
+            LOG_INFO("Drained, exit");
+            isClose_ = true;
+        }
     }
 }
 
-void WebServer::sendError_(int fd, const char* info) {
+// refuse a client that was just accepted
+void WebServer::reject_(int fd) {
     assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
+    std::shared_ptr<const std::string> busy = ErrorPages::instance()->response(503, false);
+    // the accept queue must not wait on a slow client, one try only
+    int ret = send(fd, busy->data(), busy->size(), MSG_DONTWAIT | MSG_NOSIGNAL);
     if(ret < 0) {
         LOG_WARN("send error to client[%d] error!", fd);
     }
     close(fd);
+    Metrics::instance()->addSyscall(Metrics::SYS_WRITE);
+    Metrics::instance()->addSyscall(Metrics::SYS_CLOSE);
+    Metrics::instance()->add(Metrics::REJECTS);
+    Metrics::instance()->addStatus(503);
+}
+
+// connection limits, counts the client in when it may stay
+bool WebServer::admit_(const sockaddr_in &addr) {
+    if(HttpConn::userCount >= maxConn_) {
+        LOG_WARN("Clients is full!");
+        return false;
+    }
+    if(maxConnPerIp_ > 0) {
+        std::lock_guard<std::mutex> lock(ipMtx_);
+        int &cnt = ipConns_[addr.sin_addr.s_addr];
+        if(cnt >= maxConnPerIp_) {
+            LOG_WARN("Clients of %s is full!", inet_ntoa(addr.sin_addr));
+            return false;
+        }
+        cnt++;
+    }
+    return true;
 }
 
 void WebServer::closeConn_(HttpConn* client) {
     assert(client);
     LOG_INFO("Client[%d] quit!", client->getFd());
     epoller_->delFd(client->getFd());
-    client->close();
+    if(client->request().isVerifying() && !client->isClose()) {
+        // its query would hold a pooled connection for nobody
+        SqlAsync::instance()->cancel(client->getFd());
+    }
+    if(maxConnPerIp_ > 0) {
+        // under the lock, a conn closed twice is counted out once
+        std::lock_guard<std::mutex> lock(ipMtx_);
+        if(!client->isClose()) {
+            auto it = ipConns_.find(client->getAddr().sin_addr.s_addr);
+            if(it != ipConns_.end() && --it->second <= 0) {
+                ipConns_.erase(it);
+            }
+        }
+        client->close();
+    } else {
+        client->close();
+    }
+    if(coroIO_) {
+        // a coroutine waiting on the conn sees it cancelled and returns
+        coLoop_->cancel(client->getFd());
+    }
+}
+
+void WebServer::onTimeout_(HttpConn* client) {
+    assert(client);
+    if(!client->isClose()) {
+        Metrics::instance()->add(Metrics::TIMER_EXPIRATIONS);
+    }
+    closeConn_(client);
 }
 
 void WebServer::addClient_(int fd, sockaddr_in addr) {
     assert(fd > 0);
     users_[fd].init(fd, addr);
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::closeConn_, this, &users_[fd]));
+        timer_->add(fd, timeoutMS_, std::bind(&WebServer::onTimeout_, this, &users_[fd]));
     }
-    epoller_->addFd(fd, connEvent_ | EPOLLIN);
-    setFdNonBlock(fd);
+    epoller_->addFd(fd, connEvent_ | EPOLLIN | (loopIO_ ? EPOLLOUT : 0));
+    Metrics::instance()->add(Metrics::ACCEPTS);
     LOG_INFO("Client[%d] in!", users_[fd].getFd());
+    if(coroIO_) {
+        // runs up to its first wait, a request already queued is served now
+        session_(&users_[fd]);
+    }
 }
 
-// process the listen event, put this into the heap_timer & epoller
+// process the listen event, put this into the heap_timer & epoller,
+// at most ACCEPT_BATCH clients a wakeup so the open conns are not starved
 void WebServer::dealListen_() {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    do {
-        int fd = accept(listenFd_, (struct sockaddr *) &addr, &len);
-        if(fd <= 0) {
+    acceptPending_ = false;
+    for(int i = 0; i < ACCEPT_BATCH; i++) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        // non-blocking and close-on-exec without the fcntl calls
+        int fd = accept4(listenFd_, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        Metrics::instance()->addSyscall(Metrics::SYS_ACCEPT);
+        if(fd < 0) {
+            if((errno == EMFILE || errno == ENFILE) && acceptOverflow_()) {
+                continue;
+            } else if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
             return ;
         }
-        else if(HttpConn::userCount >= MAX_FD) {
-            sendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
-            return ;
+        if(!admit_(addr)) {
+            reject_(fd);
+            continue;
+        }
+        if(config_.numa) {
+            countNuma_(fd);
         }
         addClient_(fd, addr);
-    } while(listenEvent_ & EPOLLET);
+    }
+    acceptPending_ = true;
+}
+
+// which node the connection came in on, and whether that is ours
+void WebServer::countNuma_(int fd) {
+    Numa *numa = Numa::instance();
+    int rxNode = numa->nodeOf(Numa::incomingCpu(fd));
+    Metrics::instance()->addSyscall(Metrics::SYS_SOCKOPT);
+    Metrics::instance()->addNumaAccept(rxNode, rxNode >= 0 && rxNode == numa->nodeOf(sched_getcpu()));
+}
+
+// out of fds: the reserve fd makes room to accept one client and refuse
+// it, otherwise it would stay in the accept queue and wake us forever.
+// true: a client was refused, more may be queued
+bool WebServer::acceptOverflow_() {
+    LOG_WARN("Accept: out of fds, %d clients", (int) HttpConn::userCount);
+    if(idleFd_ < 0) {
+        return false;
+    }
+    close(idleFd_);
+    int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    Metrics::instance()->addSyscall(Metrics::SYS_ACCEPT);
+    if(fd >= 0) {
+        reject_(fd);
+    }
+    idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
 }
 
 // process the read event, append the read task on threadpool
 void WebServer::dealRead_(HttpConn* client) {
     assert(client);
     extendTime_(client);
+    client->traceQueued(true);
     threadpool_->submit(std::bind(&WebServer::onRead_, this, client));
 }
 
@@ -165,12 +598,26 @@ void WebServer::dealRead_(HttpConn* client) {
 void WebServer::dealWrite_(HttpConn* client) {
     assert(client);
     extendTime_(client);
+    client->traceQueued(false);
     threadpool_->submit(std::bind(&WebServer::onWrite_, this, client));
 }
 
+// process the event of a parked sql query, continue it on threadpool,
+// in loop mode on the loop itself, the callback then writes from here
+void WebServer::dealSql_(int fd, uint32_t events) {
+    if(loopIO_) {
+        SqlAsync::instance()->onEvent(fd, events);
+        return;
+    }
+    threadpool_->submit(std::bind(&SqlAsync::onEvent, SqlAsync::instance(), fd, events));
+}
+
 void WebServer::extendTime_(HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) {
+    if(draining_) {
+        // what is still in progress gets DRAIN_MS more
+        timer_->adjust(client->getFd(), DRAIN_MS);
+    } else if(timeoutMS_ > 0) {
         timer_->adjust(client->getFd(), timeoutMS_);
     }
 }
@@ -179,6 +626,7 @@ void WebServer::onRead_(HttpConn* client) {
     assert(client);
     int ret = -1;
     int readErrno = 0;
+    client->traceDequeued();
     // read from httpconn read-buffer
     ret = client->read(&readErrno);
     if(ret <= 0 && readErrno != EAGAIN) {
@@ -194,21 +642,56 @@ void WebServer::onProcess(HttpConn* client) {
     if(client->process()) {
         // modify the event after write
         epoller_->modFd(client->getFd(), connEvent_ | EPOLLOUT);
+    } else if(client->request().isVerifying()) {
+        onVerify_(client);
     } else {
         // // modify the event if read-buffer empty
         epoller_->modFd(client->getFd(), connEvent_ | EPOLLIN);
     }
 }
 
+// park the request until its login/register query completes,
+// the worker goes back to the threadpool meanwhile
+void WebServer::onVerify_(HttpConn* client) {
+    assert(client);
+    uint64_t generation = client->generation();
+    const HttpRequest &request = client->request();
+    bool async = SqlAsync::instance()->verify(
+        request.getPost("username"), request.getPost("password"), request.isLoginVerify(), client->getFd(),
+        [this, client, generation](UserStore::RESULT res) {
+            if(client->isClose() || client->generation() != generation) {
+                // closed by the timer while parked, the fd may serve
+                // another client by now
+                return;
+            }
+            client->verified(res);
+            onVerified_(client);
+        });
+    if(!async) {
+        client->verified(UserStore::FAILED);
+        onVerified_(client);
+    }
+}
+
+void WebServer::onVerified_(HttpConn* client) {
+    if(!loopIO_) {
+        epoller_->modFd(client->getFd(), connEvent_ | EPOLLOUT);
+    } else if(flush_(client)) {
+        serve_(client);
+    }
+}
+
 void WebServer::onWrite_(HttpConn* client) {
     assert(client);
     int ret = -1;
     int writeErrno = 0;
+    client->traceDequeued();
     ret = client->write(&writeErrno);
     if(client->toWriteBytes() == 0) {
         if(client->isKeepAlive()) {
-            // convert mode to read
-            epoller_->modFd(client->getFd(), connEvent_ | EPOLLIN);
+            // a pipelined request may be buffered already,
+            // otherwise onProcess converts the mode to read
+            onProcess(client);
             return ;
         }
     } else if(ret < 0) {
@@ -221,66 +704,133 @@ void WebServer::onWrite_(HttpConn* client) {
     closeConn_(client);
 }
 
-bool WebServer::initSocket_() {
-    int ret;
-    struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
-        LOG_ERROR("Port:%d error!", port_);
-        return false;
+// loop mode: the loop thread does the I/O of its connections itself,
+// the fd stays registered edge-triggered and is never modified
+void WebServer::onLoopRead_(HttpConn* client) {
+    assert(client);
+    extendTime_(client);
+    client->traceQueued(true);
+    int readErrno = 0;
+    int ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        closeConn_(client);
+        return;
     }
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port_);
+    // a response still going out or a parked query owns the request,
+    // what was read waits in the buffer until they are done
+    if(client->toWriteBytes() == 0 && !client->request().isVerifying()) {
+        serve_(client);
+    }
+}
 
-    {
-        struct linger optLinger = {0};
-        if(openLinger_) {
-            // elegant close, send out or timeout
-            optLinger.l_onoff = 1;
-            optLinger.l_linger = 1;
+void WebServer::onLoopWrite_(HttpConn* client) {
+    assert(client);
+    if(client->toWriteBytes() == 0) {
+        // writable edge with nothing pending
+        return;
+    }
+    extendTime_(client);
+    if(flush_(client)) {
+        serve_(client);
+    }
+}
+
+// answer the buffered requests while the socket takes the responses
+void WebServer::serve_(HttpConn* client) {
+    while(client->process()) {
+        if(!flush_(client)) {
+            return;
         }
+    }
+    if(client->request().isVerifying()) {
+        onVerify_(client);
+    }
+}
 
-        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-        if(listenFd_ < 0) {
-            LOG_ERROR("Create socket[%d] error!", port_);
-            return false;
+// false: the rest waits for the next EPOLLOUT edge, or the conn is closed
+bool WebServer::flush_(HttpConn* client) {
+    int writeErrno = 0;
+    int ret = client->write(&writeErrno);
+    if(client->toWriteBytes() == 0) {
+        if(client->isKeepAlive()) {
+            return true;
         }
+    } else if(ret < 0 && writeErrno == EAGAIN) {
+        return false;
+    }
+    closeConn_(client);
+    return false;
+}
 
-        ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
-        if(ret < 0) {
-            close(listenFd_);
-            LOG_ERROR("Init socket[%d] error!", port_);
-            return false;
+// trigMode 5: the life of a connection written as one coroutine. Every
+// co_await tries the syscall first and parks only on EAGAIN, or on the
+// database; the timer closing the conn cancels whatever it waits on.
+CoTask WebServer::session_(HttpConn* client) {
+    for(;;) {
+        ssize_t n = co_await coLoop_->read(client);
+        if(client->isClose()) {
+            co_return;
+        }
+        if(n <= 0) {
+            closeConn_(client);
+            co_return;
+        }
+        extendTime_(client);
+        client->traceQueued(true);
+        for(;;) {
+            if(!client->process()) {
+                if(!client->request().isVerifying()) {
+                    // the rest of the request is still to come
+                    break;
+                }
+                const HttpRequest &request = client->request();
+                UserStore::RESULT res = co_await coLoop_->verify(client->getFd(),
+                    request.getPost("username"), request.getPost("password"), request.isLoginVerify());
+                if(client->isClose()) {
+                    co_return;
+                }
+                client->verified(res);
+            }
+            bool sent = co_await coLoop_->write(client);
+            if(client->isClose()) {
+                co_return;
+            }
+            if(!sent || !client->isKeepAlive()) {
+                closeConn_(client);
+                co_return;
+            }
+            extendTime_(client);
         }
     }
+}
 
-    // SO_REUSEADDR: if the IP + PORT bound to the currently started
-    // process conflicts with the IP + PORT occupied by the connection
-    // in the TIME_WAIT state, but the newly started process uses the
-    // SO_REUSEADDR option, then the process can be bound successfully
-    int optval = 1;
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*) &optval, sizeof(int));
-    if(ret == -1) {
-        LOG_ERROR("set socket setsockopt error!");
-        close(listenFd_);
+bool WebServer::initSocket_() {
+    int ret;
+    if(port_ > 65535 || port_ < 1024) {
+        LOG_ERROR("Port:%d error!", port_);
         return false;
     }
-
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
-    if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
+    // a process restarting gracefully hands over its bound socket
+    listenFd_ = inheritListen_();
+    if(listenFd_ < 0 && !bindSocket_()) {
         return false;
     }
 
-    // accept queue size: min(backlog = 6, somaxconn)
-    ret = listen(listenFd_, 6);
+    // accept queue size: min(backlog, somaxconn), again on an
+    // inherited socket only updates it
+    ret = listen(listenFd_, sockProfile_.backlog);
     if(ret < 0) {
         LOG_ERROR("Listen port: %d error!", port_);
         close(listenFd_);
         return false;
     }
-    ret = epoller_->addFd(listenFd_, listenEvent_ | EPOLLIN);
+    uint32_t events = listenEvent_ | EPOLLIN;
+    if(config_.workers > 0 && !config_.reusePort && strcmp(epoller_->name(), "epoll") == 0) {
+        // workers sharing the socket: a connection wakes one of them;
+        // not allowed with EPOLLRDHUP, meaningless on a listener anyway
+        events = (events & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+    }
+    ret = epoller_->addFd(listenFd_, events);
 
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
@@ -293,7 +843,330 @@ bool WebServer::initSocket_() {
     return true;
 }
 
+bool WebServer::bindSocket_() {
+    // prefork workers each bind their own socket, the kernel spreads
+    // connections over them
+    listenFd_ = bindListen(port_, openLinger_, sockProfile_, config_.workers > 0 && config_.reusePort);
+    return listenFd_ >= 0;
+}
+
+// a bound socket with the profile's options, not listening yet; -1 on error
+int WebServer::bindListen(int port, bool linger, const SockProfile &profile, bool reusePort) {
+    int ret;
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        LOG_ERROR("Create socket[%d] error!", port);
+        return -1;
+    }
+
+    struct linger optLinger = {0};
+    if(linger) {
+        // elegant close, send out or timeout
+        optLinger.l_onoff = 1;
+        optLinger.l_linger = 1;
+    }
+    ret = setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    if(ret < 0) {
+        close(fd);
+        LOG_ERROR("Init socket[%d] error!", port);
+        return -1;
+    }
+
+    // SO_REUSEADDR: if the IP + PORT bound to the currently started
+    // process conflicts with the IP + PORT occupied by the connection
+    // in the TIME_WAIT state, but the newly started process uses the
+    // SO_REUSEADDR option, then the process can be bound successfully
+    int optval = 1;
+    ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void*) &optval, sizeof(int));
+    if(ret == 0 && reusePort) {
+        ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const void*) &optval, sizeof(int));
+    }
+    if(ret == -1) {
+        LOG_ERROR("set socket setsockopt error!");
+        close(fd);
+        return -1;
+    }
+
+    // not fatal, the server works without any of them
+    profile.applyListen(fd);
+
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if(ret < 0) {
+        LOG_ERROR("Bind Port:%d error!", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// the listen fd of TWS_LISTEN_FD if it is a socket listening on port_, else -1
+int WebServer::inheritListen_() {
+    const char *env = getenv(LISTEN_FD_ENV);
+    if(!env) {
+        return -1;
+    }
+    int fd = atoi(env);
+    unsetenv(LISTEN_FD_ENV);
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    if(fd <= 2 || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening
+       || getsockname(fd, (struct sockaddr *)&addr, &addrLen) < 0 || ntohs(addr.sin_port) != port_) {
+        LOG_WARN("Inherited listen fd %s unusable, binding anew", env);
+        if(fd > 2) {
+            close(fd);
+        }
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    inherited_ = true;
+    return fd;
+}
+
+// signals arrive through a pipe and are handled by the loop
+bool WebServer::initSignals_() {
+    if(pipe2(sigPipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_ERROR("Signal pipe error!");
+        return false;
+    }
+    if(!epoller_->addFd(sigPipe_[0], EPOLLIN)) {
+        LOG_ERROR("Add signal pipe error!");
+        close(sigPipe_[0]);
+        close(sigPipe_[1]);
+        return false;
+    }
+    signalFd_ = sigPipe_[1];
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal_;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, nullptr);
+    sigaction(SIGUSR2, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    return true;
+}
+
+void WebServer::onSignal_(int sig) {
+    int saved = errno;
+    char ch = static_cast<char>(sig);
+    if(write(signalFd_, &ch, 1) < 0) {
+        // pipe full, the signal is pending there already
+    }
+    errno = saved;
+}
+
+// SIGHUP: reload, SIGUSR2: graceful restart, SIGTERM: drain and exit
+void WebServer::dealSignal_() {
+    char sigs[16];
+    ssize_t n;
+    while((n = read(sigPipe_[0], sigs, sizeof(sigs))) > 0) {
+        for(ssize_t i = 0; i < n; i++) {
+            if(sigs[i] == SIGHUP) {
+                reload_();
+            } else if(sigs[i] == SIGUSR2) {
+                restart_();
+            } else if(sigs[i] == SIGTERM) {
+                LOG_INFO("SIGTERM, shutting down");
+                drain_();
+            }
+        }
+    }
+}
+
+// reread the config file and command line, apply what can change while
+// running, flush the caches and reread the error pages
+void WebServer::reload_() {
+    LOG_INFO("========== Reload ==========");
+    if(!config_.args.empty()) {
+        Config fresh;
+        std::string err;
+        if(!config_.reparse(&fresh, &err)) {
+            LOG_ERROR("Reload: %s, config kept", err.c_str());
+        } else {
+            // set by the master, not on the command line
+            fresh.workerId = config_.workerId;
+            for(const std::string &key : config_.diff(fresh)) {
+                if(key == "log_level") {
+                    Log::instance()->setLevel(fresh.logLevel);
+                } else if(key == "max_conn") {
+                    maxConn_ = std::min(fresh.maxConn, static_cast<int>(MAX_FD));
+                } else if(key == "inline_file_size") {
+                    FileCache::instance()->setInlineSize(fresh.inlineFileSize);
+                } else if(key == "map_populate_size" || key == "map_hugepage_size" || key == "map_readahead") {
+                    FileCache::instance()->setMapPolicy(fresh.mapPopulateSize, fresh.mapHugepageSize,
+                                                        fresh.mapReadahead);
+                } else if(key == "trace_sample") {
+                    Tracer::instance()->init(fresh.traceSample);
+                } else if(key == "timeout_ms" && timeoutMS_ > 0 && fresh.timeoutMs > 0) {
+                    // conns without a timer can not get one, 0 stays 0
+                    timeoutMS_ = fresh.timeoutMs;
+                } else if(key == "max_conn_per_ip" && maxConnPerIp_ > 0 && fresh.maxConnPerIp > 0) {
+                    // the per-IP counts exist only while limited
+                    maxConnPerIp_ = fresh.maxConnPerIp;
+                } else if(config_.workerId >= 0) {
+                    LOG_WARN("Reload: %s changed, takes effect in a respawned worker", key.c_str());
+                    continue;
+                } else {
+                    LOG_WARN("Reload: %s changed, takes effect on restart (SIGUSR2)", key.c_str());
+                    continue;
+                }
+                LOG_INFO("Reload: %s changed", key.c_str());
+            }
+            config_ = fresh;
+        }
+    }
+    UserCache::instance()->clear();
+    FileCache::instance()->clear();
+    ErrorPages::instance()->load(srcDir_);
+}
+
+// start the same binary with the same command line on our listen socket,
+// once it is up stop accepting and drain. No connection is refused in
+// between: both processes accept from the one socket meanwhile.
+void WebServer::restart_() {
+    if(draining_ || restartFd_ >= 0) {
+        return;
+    }
+    if(config_.workerId >= 0) {
+        LOG_WARN("Restart: not supported in a prefork worker");
+        return;
+    }
+    if(config_.args.empty()) {
+        LOG_WARN("Restart: command line unknown");
+        return;
+    }
+    LOG_INFO("========== Restart ==========");
+    int ready[2];
+    if(pipe2(ready, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_ERROR("Restart: pipe error!");
+        return;
+    }
+    // built before fork, the child only execs; the resolved path keeps
+    // the process name, /proc/self/exe itself would turn it into "exe"
+    char exe[PATH_MAX];
+    ssize_t exeLen = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if(exeLen <= 0) {
+        close(ready[0]);
+        close(ready[1]);
+        LOG_ERROR("Restart: binary path unknown");
+        return;
+    }
+    exe[exeLen] = '\0';
+    // a deploy replaced the binary, the new one is wanted anyway
+    const char DELETED[] = " (deleted)";
+    size_t delLen = sizeof(DELETED) - 1;
+    if(static_cast<size_t>(exeLen) > delLen && strcmp(exe + exeLen - delLen, DELETED) == 0) {
+        exe[exeLen - delLen] = '\0';
+    }
+    std::vector<std::string> env;
+    for(char **e = environ; *e; e++) {
+        if(strncmp(*e, "TWS_", 4) != 0) {
+            env.push_back(*e);
+        }
+    }
+    env.push_back(std::string(LISTEN_FD_ENV) + "=" + std::to_string(listenFd_));
+    env.push_back(std::string(READY_FD_ENV) + "=" + std::to_string(ready[1]));
+    std::vector<char *> envp, argv;
+    for(std::string &e : env) {
+        envp.push_back(&e[0]);
+    }
+    envp.push_back(nullptr);
+    for(std::string &arg : config_.args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        fcntl(listenFd_, F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        execve(exe, argv.data(), envp.data());
+        _exit(127);
+    }
+    close(ready[1]);
+    if(pid < 0) {
+        close(ready[0]);
+        LOG_ERROR("Restart: fork error!");
+        return;
+    }
+    // a byte once it listens, EOF if it died first; the loop keeps
+    // serving while it starts up
+    if(!epoller_->addFd(ready[0], EPOLLIN)) {
+        LOG_ERROR("Restart: add ready pipe error!");
+        close(ready[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    restartFd_ = ready[0];
+    restartPid_ = pid;
+    restartDeadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(RESTART_WAIT_MS);
+}
+
+void WebServer::finishRestart_() {
+    char ok = 0;
+    if(read(restartFd_, &ok, 1) != 1) {
+        // EOF, or the deadline with nothing written yet
+        ok = 0;
+    }
+    epoller_->delFd(restartFd_);
+    close(restartFd_);
+    restartFd_ = -1;
+    if(!ok) {
+        LOG_ERROR("Restart: process %d did not come up, still serving", restartPid_);
+        kill(restartPid_, SIGKILL);
+        waitpid(restartPid_, nullptr, 0);
+        return;
+    }
+    LOG_INFO("Restart: process %d serves the listen socket", restartPid_);
+    drain_();
+}
+
+// tell the process that started us we are serving
+void WebServer::notifyReady_() {
+    const char *env = getenv(READY_FD_ENV);
+    if(!env) {
+        return;
+    }
+    int fd = atoi(env);
+    unsetenv(READY_FD_ENV);
+    if(fd > 2) {
+        if(!isClose_ && write(fd, "1", 1) != 1) {
+            LOG_WARN("Ready notification failed");
+        }
+        close(fd);
+    }
+}
+
+// stop accepting; a conn is closed after its current response or once
+// idle for DRAIN_MS, the loop ends with the last one
+void WebServer::drain_() {
+    if(draining_) {
+        return;
+    }
+    draining_ = true;
+    HttpConn::draining = true;
+    epoller_->delFd(listenFd_);
+    close(listenFd_);
+    listenFd_ = -1;
+    acceptPending_ = false;
+    for(auto &user : users_) {
+        if(!user.second.isClose()) {
+            timer_->add(user.first, DRAIN_MS, std::bind(&WebServer::onTimeout_, this, &user.second));
+        }
+    }
+    LOG_INFO("Draining %d clients", (int) HttpConn::userCount);
+}
+
 int WebServer::setFdNonBlock(int fd) {
     assert(fd > 0);
-    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    Metrics::instance()->addSyscall(Metrics::SYS_FCNTL, 2);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
@@ -2,51 +2,119 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <mutex>
+#include <algorithm>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include  <netinet/in.h>
 #include <arpa/inet.h>
 
-#include "epoller.h"
+#include "poller.h"
+#include "sockopts.h"
+#include "numa.h"
+#include "coloop.h"
+#include "config.h"
 #include "../timer/heaptimer.h"
 
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/sqlasync.h"
+#include "../user/sqluserstore.h"
+#include "../user/mmapuserstore.h"
 
 #include "../http/httpconn.h"
+#include "../metrics/metrics.h"
+#include "../metrics/tracer.h"
 
 class WebServer {
 public:
+    explicit WebServer(const Config &config);
     WebServer(
         int port, int trigMode, int timeoutMS, bool optLinger,
         int sqlPort, const char* sqlUser, const char* sqlPwd,
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        bool asyncSql = true, const char* userStore = "sql",
+        const char* storePath = "./users.db", int traceSample = 0,
+        const char* ioBackend = "epoll", int maxConn = MAX_FD, int maxConnPerIp = 0,
+        const char* sockProfile = "default");
     ~WebServer();
 
     void start();
+
+    // a bound socket with the profile's options, not listening yet; -1 on error
+    static int bindListen(int port, bool linger, const SockProfile &profile, bool reusePort);
+    // fds handed to the process of a graceful restart or to a prefork worker
+    static constexpr const char *LISTEN_FD_ENV = "TWS_LISTEN_FD";
+    static constexpr const char *READY_FD_ENV = "TWS_READY_FD";
 private:
+    static Config makeConfig_(
+        int port, int trigMode, int timeoutMS, bool optLinger,
+        int sqlPort, const char* sqlUser, const char* sqlPwd,
+        const char* dbName, int connPoolNum, int threadNum,
+        bool openLog, int logLevel, int logQueSize,
+        bool asyncSql, const char* userStore, const char* storePath, int traceSample,
+        const char* ioBackend, int maxConn, int maxConnPerIp, const char* sockProfile);
+
     bool initSocket_();
+    bool bindSocket_();
+    int inheritListen_();
+    bool initSignals_();
+    void notifyReady_();
     void initEventMode_(int trigMode);
     void addClient_(int fd, sockaddr_in addr);
 
     void dealListen_();
+    bool acceptOverflow_();
     void dealWrite_(HttpConn* client);
     void dealRead_(HttpConn* client);
+    void dealSql_(int fd, uint32_t events);
 
-    void sendError_(int fd, const char* info);
+    void countNuma_(int fd);
+    bool admit_(const sockaddr_in &addr);
+    void reject_(int fd);
     void extendTime_(HttpConn* client);
     void closeConn_(HttpConn* client);
+    void onTimeout_(HttpConn* client);
+    void initMetrics_();
+    static long pageFaults_(bool major);
+    void initRoutes_();
+
+    void dealSignal_();
+    static void onSignal_(int sig);
+    void reload_();
+    void restart_();
+    // the new process wrote its ready byte, or died, or RESTART_WAIT_MS passed
+    void finishRestart_();
+    void drain_();
 
     void onRead_(HttpConn* client);
     void onWrite_(HttpConn* client);
     void onProcess(HttpConn* client);
+    void onVerify_(HttpConn* client);
+    void onVerified_(HttpConn* client);
+
+    CoTask session_(HttpConn* client);
+
+    void onLoopRead_(HttpConn* client);
+    void onLoopWrite_(HttpConn* client);
+    void serve_(HttpConn* client);
+    bool flush_(HttpConn* client);
 
     static const int MAX_FD = 65536;
+    static const int ACCEPT_BATCH = 64;  // per wakeup, the rest waits a loop
+    static const int DRAIN_MS = 1000;    // idle time a draining conn is given
+    static const int RESTART_WAIT_MS = 10000;
+    static int signalFd_;   // write end of sigPipe_, for onSignal_
 
     static int setFdNonBlock(int fd);
 
@@ -54,16 +122,35 @@ private:
     bool openLinger_;
     int timeoutMS_;
     bool isClose_;
+    bool loopIO_;   // trigMode 4 and 5, connections served on the loop thread
+    bool coroIO_;   // trigMode 5, by a coroutine each
     int listenFd_;
+    int idleFd_;    // given up to accept and refuse a client on EMFILE
+    bool acceptPending_;
+    bool inherited_;    // listenFd_ came from the previous process
+    bool draining_;     // no accepting, ends with the last client
+    int restartFd_;     // ready pipe of the process started by restart_, -1: none
+    pid_t restartPid_;
+    std::chrono::steady_clock::time_point restartDeadline_;
+    int sigPipe_[2];
+    int maxConn_;
+    int maxConnPerIp_;  // 0: unlimited
     char* srcDir_;
 
     uint32_t listenEvent_;
     uint32_t connEvent_;
+    SockProfile sockProfile_;
 
     std::unique_ptr<HeapTimer> timer_;
+    std::unique_ptr<CoLoop> coLoop_;
     std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
+    std::unique_ptr<Poller> epoller_;
+    std::unique_ptr<UserStore> userStore_;
     std::unordered_map<int, HttpConn> users_;
+    std::mutex ipMtx_;  // conns are closed by the workers too
+    std::unordered_map<in_addr_t, int> ipConns_;
+    std::vector<int> sqlWake_;  // filled by SqlAsync::tick
+    Config config_;     // empty args without a command line to reload
 };
 
 #endif
\ No newline at end of file
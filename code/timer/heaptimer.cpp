@@ -103,8 +103,9 @@ void HeapTimer::tick() {
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) {
             break;
         }
-        node.callbackFun();
+        // off the heap first, the callback may add or adjust timers
         pop();
+        node.callbackFun();
     }
 }
 
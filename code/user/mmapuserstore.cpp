@@ -0,0 +1,222 @@
+#include "mmapuserstore.h"
+
+static const char STORE_MAGIC[8] = {'T', 'W', 'S', 'U', 'S', 'E', 'R', '1'};
+
+MmapUserStore::MmapUserStore() : fd_(-1), map_(nullptr), mapLen_(0), header_(nullptr), mask_(0) {
+    static_assert(sizeof(Header) == 64, "header is one cache line");
+    static_assert(sizeof(Slot) == 128, "slot is two cache lines");
+}
+
+MmapUserStore::~MmapUserStore() {
+    close();
+}
+
+bool MmapUserStore::open(const char *path, uint32_t slotNum) {
+    assert(path && slotNum > 0);
+    close();
+    fd_ = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd_ < 0) {
+        LOG_ERROR("UserStore open %s error!", path);
+        return false;
+    }
+    flock(fd_, LOCK_EX);
+    struct stat st;
+    fstat(fd_, &st);
+    Header header;
+    bool created = false;
+    if(st.st_size == 0) {
+        uint32_t n = 1;
+        while(n < slotNum) {
+            n <<= 1;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header.version = 1;
+        header.capacity = n;
+        if(ftruncate(fd_, sizeof(Header) + sizeof(Slot) * static_cast<size_t>(n)) < 0
+            || pwrite(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+            LOG_ERROR("UserStore init %s error!", path);
+            flock(fd_, LOCK_UN);
+            close();
+            return false;
+        }
+        fsync(fd_);
+        created = true;
+    } else if(pread(fd_, &header, sizeof(header), 0) != sizeof(header)
+            || memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0
+            || header.version != 1 || header.capacity == 0
+            || (header.capacity & (header.capacity - 1))
+            || static_cast<size_t>(st.st_size) < sizeof(Header) + sizeof(Slot) * static_cast<size_t>(header.capacity)) {
+        LOG_ERROR("UserStore %s is not a user store!", path);
+        flock(fd_, LOCK_UN);
+        close();
+        return false;
+    }
+    mapLen_ = sizeof(Header) + sizeof(Slot) * static_cast<size_t>(header.capacity);
+    void *ret = mmap(nullptr, mapLen_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(ret == MAP_FAILED) {
+        LOG_ERROR("UserStore mmap %s error!", path);
+        flock(fd_, LOCK_UN);
+        close();
+        return false;
+    }
+    map_ = static_cast<char *>(ret);
+    header_ = reinterpret_cast<Header *>(map_);
+    mask_ = header_->capacity - 1;
+    bool ok = created || recover_();
+    flock(fd_, LOCK_UN);
+    LOG_INFO("UserStore %s: %u users, capacity %u", path, count(), capacity());
+    return ok;
+}
+
+void MmapUserStore::close() {
+    if(map_) {
+        munmap(map_, mapLen_);
+        map_ = nullptr;
+        header_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+uint32_t MmapUserStore::count() const {
+    return header_ ? __atomic_load_n(&header_->count, __ATOMIC_ACQUIRE) : 0;
+}
+
+uint32_t MmapUserStore::capacity() const {
+    return header_ ? header_->capacity : 0;
+}
+
+MmapUserStore::Slot *MmapUserStore::slot_(uint32_t i) const {
+    return reinterpret_cast<Slot *>(map_ + sizeof(Header)) + i;
+}
+
+// linear probing, stops at the first empty slot
+const MmapUserStore::Slot *MmapUserStore::find_(const std::string &name) const {
+    uint32_t i = hash_(name.data(), name.size()) & mask_;
+    for(uint32_t n = 0; n <= mask_; n++, i = (i + 1) & mask_) {
+        const Slot *slot = slot_(i);
+        uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if(state == EMPTY) {
+            return nullptr;
+        }
+        if(state == READY && slot->nameLen == name.size()
+            && memcmp(slot->name, name.data(), name.size()) == 0) {
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+UserStore::RESULT MmapUserStore::query(const std::string &name, std::string &pwd, bool &found) {
+    if(!map_) {
+        return FAILED;
+    }
+    const Slot *slot = find_(name);
+    found = (slot != nullptr);
+    if(found) {
+        pwd.assign(slot->pwd, slot->pwdLen);
+    }
+    return OK;
+}
+
+UserStore::RESULT MmapUserStore::insert(const std::string &name, const std::string &pwd) {
+    if(!map_ || name.size() > NAME_LEN || pwd.size() > PWD_LEN) {
+        return FAILED;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    flock(fd_, LOCK_EX);
+    bool ok = false;
+    if(count() >= header_->capacity / 4 * 3) {
+        LOG_WARN("UserStore is full!");
+    } else if(!find_(name)) {
+        uint32_t i = hash_(name.data(), name.size()) & mask_;
+        for(; ; i = (i + 1) & mask_) {
+            // a slot left WRITING by a crashed writer is free again
+            if(__atomic_load_n(&slot_(i)->state, __ATOMIC_ACQUIRE) != READY) {
+                break;
+            }
+        }
+        publish_(slot_(i), name, pwd);
+        __atomic_add_fetch(&header_->count, 1, __ATOMIC_RELEASE);
+        sync_(header_, sizeof(Header));
+        ok = true;
+    }
+    flock(fd_, LOCK_UN);
+    return ok ? OK : FAILED;
+}
+
+// data first, then the state: a reader never sees a half written slot
+// and a crash leaves at most one WRITING slot behind
+void MmapUserStore::publish_(Slot *slot, const std::string &name, const std::string &pwd) {
+    __atomic_store_n(&slot->state, WRITING, __ATOMIC_RELEASE);
+    slot->nameLen = static_cast<uint8_t>(name.size());
+    slot->pwdLen = static_cast<uint8_t>(pwd.size());
+    memset(slot->name, 0, NAME_LEN);
+    memset(slot->pwd, 0, PWD_LEN);
+    memcpy(slot->name, name.data(), name.size());
+    memcpy(slot->pwd, pwd.data(), pwd.size());
+    slot->checksum = checksum_(slot);
+    sync_(slot, sizeof(Slot));
+    __atomic_store_n(&slot->state, READY, __ATOMIC_RELEASE);
+    sync_(slot, sizeof(Slot));
+}
+
+void MmapUserStore::sync_(const void *addr, size_t len) {
+    // msync wants a page aligned address
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(addr) + len;
+    msync(reinterpret_cast<void *>(begin), end - begin, MS_SYNC);
+}
+
+// called with the file locked, before any lookup
+bool MmapUserStore::recover_() {
+    std::vector<Slot> valid;
+    bool dirty = false;
+    for(uint32_t i = 0; i <= mask_; i++) {
+        Slot *slot = slot_(i);
+        if(slot->state == EMPTY) {
+            continue;
+        }
+        if(slot->state == READY && slot->nameLen <= NAME_LEN && slot->pwdLen <= PWD_LEN
+            && slot->checksum == checksum_(slot)) {
+            valid.push_back(*slot);
+        } else {
+            dirty = true;
+        }
+    }
+    if(!dirty && valid.size() == header_->count) {
+        return true;
+    }
+    // dropping a slot in place would cut probe chains, rebuild the table
+    LOG_WARN("UserStore recover: %d valid users", (int)valid.size());
+    memset(map_ + sizeof(Header), 0, sizeof(Slot) * static_cast<size_t>(mask_ + 1));
+    for(const Slot &slot : valid) {
+        uint32_t i = hash_(slot.name, slot.nameLen) & mask_;
+        while(slot_(i)->state != EMPTY) {
+            i = (i + 1) & mask_;
+        }
+        *slot_(i) = slot;
+    }
+    header_->count = static_cast<uint32_t>(valid.size());
+    return msync(map_, mapLen_, MS_SYNC) == 0;
+}
+
+// FNV-1a
+uint64_t MmapUserStore::hash_(const char *str, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        h ^= static_cast<uint8_t>(str[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint32_t MmapUserStore::checksum_(const Slot *slot) {
+    uint64_t h = hash_(reinterpret_cast<const char *>(&slot->nameLen),
+                        sizeof(Slot) - offsetof(Slot, nameLen));
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
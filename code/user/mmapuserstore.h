@@ -0,0 +1,84 @@
+#ifndef MMAPUSERSTORE_H
+#define MMAPUSERSTORE_H
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "userstore.h"
+#include "../log/log.h"
+
+// Embedded user store: an open-addressing hash table in a memory-mapped file.
+// A slot is published once (WRITING -> READY) and never changed afterwards,
+// so lookups are lock-free reads of the shared mapping. Registrations are
+// serialized by a mutex and flock(), which also covers other processes.
+// A slot left WRITING or with a bad checksum by a crash is dropped when
+// the file is opened, by rebuilding the table from the valid slots.
+class MmapUserStore : public UserStore {
+public:
+    MmapUserStore();
+    ~MmapUserStore();
+
+    // slotNum is only used when the file is created, rounded up to 2^n
+    bool open(const char *path, uint32_t slotNum = 65536);
+    void close();
+
+    RESULT query(const std::string &name, std::string &pwd, bool &found) override;
+    RESULT insert(const std::string &name, const std::string &pwd) override;
+    const char *name() const override {
+        return "mmap";
+    }
+
+    uint32_t count() const;
+    uint32_t capacity() const;
+
+private:
+    static const uint32_t EMPTY = 0;
+    static const uint32_t WRITING = 1;
+    static const uint32_t READY = 2;
+
+    static const size_t NAME_LEN = 56;
+    static const size_t PWD_LEN = 60;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t count;
+        char pad[44];
+    };
+
+    struct Slot {
+        uint32_t state;
+        uint32_t checksum;
+        uint8_t nameLen;
+        uint8_t pwdLen;
+        char pad[2];
+        char name[NAME_LEN];
+        char pwd[PWD_LEN];
+    };
+
+    Slot *slot_(uint32_t i) const;
+    const Slot *find_(const std::string &name) const;
+    bool recover_();
+    void publish_(Slot *slot, const std::string &name, const std::string &pwd);
+    void sync_(const void *addr, size_t len);
+
+    static uint64_t hash_(const char *str, size_t len);
+    static uint32_t checksum_(const Slot *slot);
+
+    int fd_;
+    char *map_;
+    size_t mapLen_;
+    Header *header_;
+    uint32_t mask_;
+    std::mutex mtx_;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "sqluserstore.h"
+
+UserStore::RESULT SqlUserStore::query(const std::string &name, std::string &pwd, bool &found) {
+    SqlConn *conn = nullptr;
+    SqlConnRAII connRAII(&conn, SqlConnPool::instance());
+    if(!conn) {
+        // the pool is busy, not a wrong password
+        return UNAVAILABLE;
+    }
+    MYSQL_STMT *stmt = conn->queryStmt;
+    if(!conn->bindQuery(name) || mysql_stmt_execute(stmt) || mysql_stmt_store_result(stmt)) {
+        LOG_WARN("Select error: %s", mysql_stmt_error(stmt));
+        conn->checkError(mysql_stmt_errno(stmt));
+        return FAILED;
+    }
+    found = conn->fetchPassword(pwd);
+    mysql_stmt_free_result(stmt);
+    return OK;
+}
+
+UserStore::RESULT SqlUserStore::insert(const std::string &name, const std::string &pwd) {
+    SqlConn *conn = nullptr;
+    SqlConnRAII connRAII(&conn, SqlConnPool::instance());
+    if(!conn) {
+        return UNAVAILABLE;
+    }
+    MYSQL_STMT *stmt = conn->insertStmt;
+    if(!conn->bindInsert(name, pwd) || mysql_stmt_execute(stmt)) {
+        LOG_DEBUG("Insert error: %s", mysql_stmt_error(stmt));
+        conn->checkError(mysql_stmt_errno(stmt));
+        return FAILED;
+    }
+    return OK;
+}
@@ -0,0 +1,18 @@
+#ifndef SQLUSERSTORE_H
+#define SQLUSERSTORE_H
+
+#include "userstore.h"
+#include "../pool/sqlconnpool.h"
+#include "../log/log.h"
+
+// the user table behind SqlConnPool, queried with the cached statements
+class SqlUserStore : public UserStore {
+public:
+    RESULT query(const std::string &name, std::string &pwd, bool &found) override;
+    RESULT insert(const std::string &name, const std::string &pwd) override;
+    const char *name() const override {
+        return "sql";
+    }
+};
+
+#endif
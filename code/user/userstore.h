@@ -0,0 +1,23 @@
+#ifndef USERSTORE_H
+#define USERSTORE_H
+
+#include <string>
+
+// backend of HttpRequest::userVerify()
+class UserStore {
+public:
+    enum RESULT {
+        OK,
+        FAILED,         // the backend failed; insert: or the name is used
+        UNAVAILABLE,    // no connection free in time, answered with 503
+    };
+
+    virtual ~UserStore() = default;
+
+    // not OK: found/pwd are undefined
+    virtual RESULT query(const std::string &name, std::string &pwd, bool &found) = 0;
+    virtual RESULT insert(const std::string &name, const std::string &pwd) = 0;
+    virtual const char *name() const = 0;
+};
+
+#endif
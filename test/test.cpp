@@ -0,0 +1,386 @@
+// Unit tests of the classes that are easy to get subtly wrong, run by
+// `make test` in build/. Prints each failed check, exits 1 if any.
+//
+//   unittest [filter]
+//
+// runs only the groups whose name contains filter.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "../bench/histogram.h"
+#include "../code/buffer/buffer.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/router.h"
+#include "../code/cache/filecache.h"
+#include "../code/user/mmapuserstore.h"
+
+static int g_checks = 0;
+static int g_failed = 0;
+
+#define CHECK(cond) do { \
+        g_checks++; \
+        if(!(cond)) { \
+            g_failed++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while(0)
+
+#define CHECK_EQ(a, b) do { \
+        g_checks++; \
+        if(!((a) == (b))) { \
+            g_failed++; \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #a, #b); \
+        } \
+    } while(0)
+
+/* ---------------- Router ---------------- */
+
+// the handler of a route writes its name into the reply
+static Router::Handler named(const char *name) {
+    return [name](HttpRequest &, const Router::Params &, Router::Reply *reply) {
+        reply->body = name;
+    };
+}
+
+// the name of the route path takes, "" if none
+static std::string route(const char *method, const char *path, Router::Params *params = nullptr) {
+    Router::Params local;
+    const Router::Handler *handler = Router::instance()->match(method, path, params ? params : &local);
+    if(!handler) {
+        return "";
+    }
+    HttpRequest request;
+    Router::Reply reply;
+    (*handler)(request, params ? *params : local, &reply);
+    return reply.body;
+}
+
+static void testRouter() {
+    Router *router = Router::instance();
+    router->clear();
+    CHECK(router->add("GET", "/", named("root")));
+    CHECK(router->add("*", "/login", named("login")));
+    CHECK(router->add("POST", "/login", named("login-post")));
+    CHECK(router->add("GET", "/api/users/:id", named("user")));
+    CHECK(router->add("GET", "/api/users/me", named("me")));
+    CHECK(router->add("GET", "/api/users/:id/posts/:post", named("post")));
+    CHECK(router->add("GET", "/static/*file", named("static")));
+    CHECK(!router->add("FETCH", "/x", named("x")));
+
+    // static routes, method specific before "*"
+    CHECK_EQ(route("GET", "/"), "root");
+    CHECK_EQ(route("GET", "/login"), "login");
+    CHECK_EQ(route("HEAD", "/login"), "login");
+    CHECK_EQ(route("POST", "/login"), "login-post");
+    CHECK_EQ(route("POST", "/"), "");
+    CHECK_EQ(route("GET", "/login/"), "");
+    CHECK_EQ(route("GET", "/logi"), "");
+    CHECK_EQ(route("GET", "/nothing.html"), "");
+
+    // a static edge is tried before ":id"
+    Router::Params params;
+    CHECK_EQ(route("GET", "/api/users/me", &params), "me");
+    CHECK_EQ(params.size(), 0);
+    CHECK_EQ(route("GET", "/api/users/42", &params), "user");
+    CHECK(params.get("id") == "42");
+    CHECK(params.get("post").empty());
+    CHECK_EQ(route("GET", "/api/users/42/posts/7", &params), "post");
+    CHECK(params.get("id") == "42");
+    CHECK(params.get("post") == "7");
+    // ":name" takes exactly one non-empty segment
+    CHECK_EQ(route("GET", "/api/users/"), "");
+    CHECK_EQ(route("GET", "/api/users/42/posts"), "");
+    CHECK_EQ(route("PUT", "/api/users/42"), "");
+
+    // "*file" takes the rest of the path
+    CHECK_EQ(route("GET", "/static/css/site/main.css", &params), "static");
+    CHECK(params.get("file") == "css/site/main.css");
+    CHECK_EQ(route("GET", "/stat"), "");
+
+    // an equal route is replaced
+    CHECK(router->add("GET", "/api/users/:id", named("user2")));
+    CHECK_EQ(route("GET", "/api/users/42"), "user2");
+    router->clear();
+    CHECK_EQ(route("GET", "/"), "");
+}
+
+/* ---------------- FileCache::normalize ---------------- */
+
+// the normalized path, "!" if url does not normalize
+static std::string normalized(const std::string &url) {
+    std::string path;
+    return FileCache::normalize(url, &path) ? path : "!";
+}
+
+static void testNormalize() {
+    CHECK_EQ(normalized("/"), "");
+    CHECK_EQ(normalized("/index.html"), "index.html");
+    CHECK_EQ(normalized("/a/./b//c/../d?q=1"), "a/b/d");
+    CHECK_EQ(normalized("/a/b#frag"), "a/b");
+    CHECK_EQ(normalized("/a/b/"), "a/b");
+    CHECK_EQ(normalized("/a/.."), "");
+    CHECK_EQ(normalized("/%61%2Fb"), "a/b");
+    CHECK_EQ(normalized("/a%20b"), "a b");
+    CHECK_EQ(normalized("/..."), "...");
+
+    // never above the root, however it is spelled
+    CHECK_EQ(normalized("/.."), "!");
+    CHECK_EQ(normalized("/../etc/passwd"), "!");
+    CHECK_EQ(normalized("/a/../../etc/passwd"), "!");
+    CHECK_EQ(normalized("/a/./../.."), "!");
+    CHECK_EQ(normalized("/%2e%2e/etc/passwd"), "!");
+    CHECK_EQ(normalized("/%2E%2E%2fetc%2fpasswd"), "!");
+    CHECK_EQ(normalized("/a/%2e%2e/%2e%2e/x"), "!");
+    // ".." in the query is not part of the path
+    CHECK_EQ(normalized("/a?../../x"), "a");
+
+    // a NUL or a bad escape
+    CHECK_EQ(normalized("/a%00.html"), "!");
+    CHECK_EQ(normalized(std::string("/a\0b", 4)), "!");
+    CHECK_EQ(normalized("/a%2"), "!");
+    CHECK_EQ(normalized("/a%zz"), "!");
+    CHECK_EQ(normalized("/a%"), "!");
+}
+
+/* ---------------- chunked decoding ---------------- */
+
+// parses req fed split bytes at a time (0: at once), the last result
+static HttpRequest::HTTP_CODE parseAll(HttpRequest &request, const std::string &req, size_t split = 0) {
+    Buffer buff;
+    request.init();
+    if(split == 0) {
+        buff.append(req);
+        return request.parse(buff);
+    }
+    HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+    for(size_t off = 0; off < req.size() && ret == HttpRequest::NO_REQUEST; off += split) {
+        buff.append(req.data() + off, std::min(split, req.size() - off));
+        ret = request.parse(buff);
+    }
+    return ret;
+}
+
+static void testChunked() {
+    const std::string head = "POST /upload HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n";
+    std::string req = head + "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\n\r\n";
+    HttpRequest request;
+    for(size_t split : {0, 1, 3, 7}) {
+        CHECK_EQ(parseAll(request, req, split), HttpRequest::GET_REQUEST);
+        CHECK_EQ(request.body(), "hello world");
+        CHECK_EQ(request.bodyLen(), 11u);
+    }
+
+    // hex sizes, trailer fields ignored
+    std::string big(0x1a, 'x');
+    CHECK_EQ(parseAll(request, head + "1A\r\n" + big + "\r\n0\r\nX-Sum: 1\r\n\r\n"), HttpRequest::GET_REQUEST);
+    CHECK_EQ(request.body(), big);
+
+    // incomplete until the last empty line
+    CHECK_EQ(parseAll(request, head + "5\r\nhello\r\n0\r\n"), HttpRequest::NO_REQUEST);
+    CHECK_EQ(parseAll(request, head + "5\r\nhel"), HttpRequest::NO_REQUEST);
+
+    // a pipelined request stays in the buffer
+    Buffer buff;
+    buff.append(head + "3\r\nabc\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    request.init();
+    CHECK_EQ(request.parse(buff), HttpRequest::GET_REQUEST);
+    CHECK_EQ(request.body(), "abc");
+    CHECK_EQ(buff.retrieveAllToStr(), "GET / HTTP/1.1\r\n\r\n");
+
+    // malformed framing
+    CHECK_EQ(parseAll(request, head + "zz\r\n"), HttpRequest::BAD_REQUEST);
+    CHECK_EQ(parseAll(request, head + "\r\n"), HttpRequest::BAD_REQUEST);
+    CHECK_EQ(parseAll(request, head + "1000000000000000\r\n"), HttpRequest::BAD_REQUEST);
+    CHECK_EQ(parseAll(request, head + "3\r\nabcX\r\n"), HttpRequest::BAD_REQUEST);
+    CHECK_EQ(parseAll(request, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"), HttpRequest::BAD_REQUEST);
+
+    // the chunks together are bounded by maxBodySize
+    size_t maxBody = HttpRequest::maxBodySize;
+    HttpRequest::maxBodySize = 8;
+    CHECK_EQ(parseAll(request, head + "5\r\nhello\r\n"), HttpRequest::NO_REQUEST);
+    CHECK_EQ(parseAll(request, head + "5\r\nhello\r\n4\r\n"), HttpRequest::ENTITY_TOO_LARGE);
+    CHECK_EQ(parseAll(request, head + "ffffffff\r\n"), HttpRequest::ENTITY_TOO_LARGE);
+    HttpRequest::maxBodySize = maxBody;
+}
+
+/* ---------------- MmapUserStore recovery ---------------- */
+
+static const size_t SLOT_SIZE = 128;
+static const size_t NAME_OFFSET = 12;   // state, checksum, nameLen, pwdLen, pad
+
+// the file offset of name's slot, 0 if not found
+static off_t findSlot(const std::string &file, const std::string &name) {
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    fstat(fd, &st);
+    std::string data(st.st_size, '\0');
+    CHECK_EQ(pread(fd, &data[0], data.size(), 0), static_cast<ssize_t>(data.size()));
+    close(fd);
+    for(size_t off = 64; off + SLOT_SIZE <= data.size(); off += SLOT_SIZE) {
+        if(data.compare(off + NAME_OFFSET, name.size(), name) == 0
+            && data[off + NAME_OFFSET + name.size()] == '\0') {
+            return off;
+        }
+    }
+    return 0;
+}
+
+static void poke(const std::string &file, off_t off, const void *data, size_t len) {
+    int fd = open(file.c_str(), O_WRONLY);
+    CHECK_EQ(pwrite(fd, data, len, off), static_cast<ssize_t>(len));
+    close(fd);
+}
+
+static void testMmapUserStore() {
+    char dir[] = "/tmp/unittest.XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    std::string file = std::string(dir) + "/users.db";
+
+    MmapUserStore store;
+    CHECK(store.open(file.c_str(), 100));
+    CHECK_EQ(store.capacity(), 128u);
+    CHECK_EQ(store.insert("alice", "a-pwd"), UserStore::OK);
+    CHECK_EQ(store.insert("bob", "b-pwd"), UserStore::OK);
+    CHECK_EQ(store.insert("carol", "c-pwd"), UserStore::OK);
+    CHECK_EQ(store.insert("dave", "d-pwd"), UserStore::OK);
+    CHECK_EQ(store.insert("alice", "again"), UserStore::FAILED);
+    CHECK_EQ(store.count(), 4u);
+    store.close();
+
+    // a torn write: bob's slot still WRITING, carol's password changed
+    // behind the checksum
+    off_t bob = findSlot(file, "bob");
+    off_t carol = findSlot(file, "carol");
+    CHECK(bob > 0 && carol > 0);
+    uint32_t writing = 1;
+    poke(file, bob, &writing, sizeof(writing));
+    poke(file, carol + NAME_OFFSET + 56, "X", 1);
+
+    CHECK(store.open(file.c_str()));
+    CHECK_EQ(store.count(), 2u);
+    bool found = false;
+    std::string pwd;
+    CHECK_EQ(store.query("alice", pwd, found), UserStore::OK);
+    CHECK(found && pwd == "a-pwd");
+    CHECK_EQ(store.query("dave", pwd, found), UserStore::OK);
+    CHECK(found && pwd == "d-pwd");
+    CHECK_EQ(store.query("bob", pwd, found), UserStore::OK);
+    CHECK(!found);
+    CHECK_EQ(store.query("carol", pwd, found), UserStore::OK);
+    CHECK(!found);
+    // the dropped names can be registered again, and survive a reopen
+    CHECK_EQ(store.insert("bob", "b-new"), UserStore::OK);
+    store.close();
+    CHECK(store.open(file.c_str()));
+    CHECK_EQ(store.count(), 3u);
+    CHECK_EQ(store.query("bob", pwd, found), UserStore::OK);
+    CHECK(found && pwd == "b-new");
+    store.close();
+
+    // a file that is not a store is refused
+    std::string other = std::string(dir) + "/other.db";
+    int fd = open(other.c_str(), O_WRONLY | O_CREAT, 0600);
+    CHECK_EQ(write(fd, "not a user store", 16), 16);
+    close(fd);
+    CHECK(!store.open(other.c_str()));
+
+    unlink(file.c_str());
+    unlink(other.c_str());
+    rmdir(dir);
+}
+
+/* ---------------- Histogram ---------------- */
+
+static void testHistogram() {
+    // one bucket per value below SUB_COUNT
+    for(uint64_t v = 0; v < Histogram::SUB_COUNT; v++) {
+        CHECK_EQ(Histogram::index(v), static_cast<int>(v));
+        CHECK_EQ(Histogram::upper(Histogram::index(v)), v);
+    }
+    // then SUB_COUNT buckets per power of two
+    CHECK_EQ(Histogram::index(128), 128);
+    CHECK_EQ(Histogram::index(129), 129);
+    CHECK_EQ(Histogram::index(255), 255);
+    CHECK_EQ(Histogram::index(256), 256);
+    CHECK_EQ(Histogram::index(257), 256);
+    CHECK_EQ(Histogram::index(258), 257);
+    CHECK_EQ(Histogram::upper(256), 257u);
+    CHECK_EQ(Histogram::index(UINT64_MAX), Histogram::BUCKETS - 1);
+    CHECK_EQ(Histogram::upper(Histogram::BUCKETS - 1), UINT64_MAX);
+
+    // every value lies in its bucket, off by less than 1%, and the
+    // buckets are contiguous
+    std::vector<uint64_t> values;
+    for(int shift = 0; shift < 64; shift++) {
+        uint64_t base = 1ULL << shift;
+        for(uint64_t v : {base - 1, base, base + 1, base + base / 3, base * 2 - 1}) {
+            values.push_back(v);
+        }
+    }
+    for(uint64_t v : values) {
+        int i = Histogram::index(v);
+        CHECK(i >= 0 && i < Histogram::BUCKETS);
+        CHECK(Histogram::upper(i) >= v);
+        CHECK(i == 0 || Histogram::upper(i - 1) < v);
+        CHECK(Histogram::upper(i) - v <= v / 128);
+    }
+    for(int i = 1; i < Histogram::BUCKETS; i++) {
+        CHECK_EQ(Histogram::index(Histogram::upper(i - 1) + 1), i);
+    }
+
+    Histogram hist;
+    CHECK_EQ(hist.percentile(0.5), 0u);
+    CHECK_EQ(hist.min(), 0u);
+    for(uint64_t v = 1; v <= 1000; v++) {
+        hist.record(v);
+    }
+    CHECK_EQ(hist.count(), 1000u);
+    CHECK_EQ(hist.min(), 1u);
+    CHECK_EQ(hist.max(), 1000u);
+    CHECK(hist.mean() == 500.5);
+    // the upper bound of the bucket, never above max
+    CHECK_EQ(hist.percentile(0.0), 1u);
+    CHECK_EQ(hist.percentile(0.1), 100u);
+    CHECK_EQ(hist.percentile(0.5), 501u);
+    CHECK_EQ(hist.percentile(0.99), 991u);
+    CHECK_EQ(hist.percentile(1.0), 1000u);
+
+    Histogram other;
+    other.record(5000);
+    hist.merge(other);
+    CHECK_EQ(hist.count(), 1001u);
+    CHECK_EQ(hist.max(), 5000u);
+    CHECK_EQ(hist.percentile(1.0), 5000u);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = argc > 1 ? argv[1] : nullptr;
+    struct Group {
+        const char *name;
+        std::function<void()> run;
+    } groups[] = {
+        {"router", testRouter},
+        {"normalize", testNormalize},
+        {"chunked", testChunked},
+        {"mmapuserstore", testMmapUserStore},
+        {"histogram", testHistogram},
+    };
+    for(const Group &group : groups) {
+        if(filter && !strstr(group.name, filter)) {
+            continue;
+        }
+        int failed = g_failed;
+        group.run();
+        printf("%-16s %s\n", group.name, g_failed == failed ? "ok" : "FAILED");
+    }
+    printf("%d checks, %d failed\n", g_checks, g_failed);
+    return g_failed ? 1 : 0;
+}